@@ -1,9 +1,15 @@
 #include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
 #include <stdbool.h>
+#include <unistd.h>
 #include "sm_err.h"
 #include "service.h"
 #include "bus.h"
 #include "display.h"
+#include "filter.h"
+#include "ingest.h"
+#include "snapshot.h"
+#include "cache.h"
 #define STS state[0]
 #define STSBUS state[0].bus
 
@@ -14,130 +20,53 @@ static bool system_only = false;
 struct bus_state state[2] = {0};
 
 /**
- * Updates a specific property of a service based on the received D-Bus message.
+ * Applies a change of the active or sub state of a unit.
  *
- * This function is called for each dictionary entry in the D-Bus message. It
- * checks if the key is a property that needs to be updated, and if so, it
- * updates the corresponding field in the Service struct.
- *
- * @param svc The Service struct to be updated.
- * @param reply The D-Bus message containing the service property updates.
- * @return 1 if a property was updated, 0 otherwise.
+ * @param bus The bus the unit belongs to.
+ * @param rec The INGEST_CHANGED record, states it does not carry are NULL.
+ * @return true if the unit changed, false otherwise.
  */
-static int bus_update_service_property(Service *svc, sd_bus_message *reply)
+static bool bus_unit_changed(Bus *bus, ingest_record *rec)
 {
-    // Format of message at this point is: '{sv}'
-    int rc;
-    const char *k, *active, *sub;
+    Service *svc = service_get_name(bus, rec->unit);
+    const char *active, *sub;
 
-    // s: Next item is the key out of the dictionary
-    rc = sd_bus_message_read(reply, "s", &k);
-    if (rc < 0)
-        sm_err_set("Cannot read dictionary key item from array: %s\n", strerror(-rc));
+    /* Units not listed, or excluded, have no row to update */
+    if (!svc || !svc->listed)
+        return false;
 
-    // If its a property we want to measure, update the related property
-    if (strcmp(k, "ActiveState") == 0)
+    /* States are atoms and compare by pointer */
+    if (rec->active)
     {
-        // v: Variant, always a string in this case
-        rc = sd_bus_message_read(reply, "v", "s", &active);
-        if (rc < 0)
-            sm_err_set("Cannot fetch value from dictionary: %s\n", strerror(-rc));
-        BUS_CPY_PROPERTY(svc, active);
-
-        return 1;
+        active = service_atom(rec->active);
+        if (!active)
+            sm_err_set("Failed to update active property");
+        if (svc->active != active)
+        {
+            service_set_active(bus, svc, active);
+            svc->changed++;
+        }
     }
 
-    else if (strcmp(k, "SubState") == 0)
+    if (rec->sub)
     {
-        // v: Variant, always a string in this case
-        rc = sd_bus_message_read(reply, "v", "s", &sub);
-        if (rc < 0)
-            sm_err_set("Cannot fetch value from dictionary: %s\n", strerror(-rc));
-        BUS_CPY_PROPERTY(svc, sub);
-
-        return 1;
-    }
-
-    else
-        // Anything else is skipped
-        sd_bus_message_skip(reply, NULL);
-
-    return 0;
-}
-
-/**
- * Callback function that handles changes to a systemd service.
- *
- * This function is called when a change is detected in a systemd service. It reads the
- * updated properties from the D-Bus message and updates the corresponding fields in the
- * Service struct. If any properties have changed, it redraws the screen to reflect the
- * updated service status.
- *
- * @param reply The D-Bus message containing the updated service properties.
- * @param data A pointer to the Service struct to be updated.
- * @param err An error object, if an error occurred.
- * @return 0 on success, or a negative error code on failure.
- */
-static int bus_unit_changed(sd_bus_message *reply, void *data, sd_bus_error *err)
-{
-    Service *svc = (Service *)data;
-    const char *iface = NULL;
-    int rc;
-
-    /* Message format: sa{sv}as */
-
-    if (sd_bus_error_is_set(err))
-        sm_err_set("Changed unit callback failed: %s\n", err->message);
-
-    /* s: Interface name */
-    rc = sd_bus_message_read(reply, "s", &iface);
-    if (rc < 0)
-        sm_err_set("Cannot read dbus messge: %s\n", strerror(-rc));
-
-    /* If the interface is not a unit, we dont care */
-    if (strcmp(iface, SD_IFACE("Unit")) != 0)
-        goto fin;
-
-    /* a: Array of dictionaries */
-    rc = sd_bus_message_enter_container(reply, 'a', "{sv}");
-    if (rc < 0)
-        sm_err_set("Cannot read array in dbus message: %s\n", strerror(-rc));
-
-    /* Array of dictionaries */
-    while (true)
-    {
-        /* {..}: Dictionary itself */
-        rc = sd_bus_message_enter_container(reply, 'e', "sv");
-        if (rc < 0)
-            sm_err_set("Cannot read dict item in dbus message: %s\n", strerror(-rc));
-
-        /* No more array entries to read */
-        if (rc == 0)
-            break;
-
-        svc->changed += bus_update_service_property(svc, reply);
-        if (svc->changed)
+        sub = service_atom(rec->sub);
+        if (!sub)
+            sm_err_set("Failed to update sub property");
+        if (svc->sub != sub)
         {
-            display_redraw_row(svc);
-            svc->last_update = service_now();
+            svc->sub = sub;
+            svc->changed++;
         }
-
-        if (sd_bus_message_exit_container(reply) < 0)
-            sm_err_set("Cannot exit dictionary: %s\n", strerror(-rc));
     }
 
-    sd_bus_message_exit_container(reply);
+    if (!svc->changed)
+        return false;
 
-    /* Redraw screen if something changed */
-    if (svc->changed)
-    {
-        svc->changed = 0;
-        display_redraw(bus_currently_displayed());
-    }
-
-fin:
-    sd_bus_error_free(err);
-    return 0;
+    svc->changed = 0;
+    display_unit_changed(bus, svc);
+    display_redraw_row(svc);
+    return true;
 }
 
 /**
@@ -193,81 +122,77 @@ static int bus_unit_property(Bus *bus, const char *object, const char *iface, co
 }
 
 /**
- * Updates or creates a service entry based on D-Bus message data.
+ * Updates or creates a service entry from a listed unit.
  *
- * This function processes a D-Bus message containing systemd unit information and either
- * updates an existing service entry or creates a new one. It handles:
- * - Reading unit properties from the D-Bus message
+ * This function takes a unit of a listing made by the ingestion thread and
+ * either updates an existing service entry or creates a new one. It handles:
  * - Creating or updating Service struct fields
  * - Tracking changes to service properties
- * - Registering for D-Bus signal notifications for the service
  * - Adding new services to the service list
  *
- * @param reply The D-Bus message containing unit information
  * @param st The bus state containing the services list
- * @param now Current timestamp for update tracking
- * @return 1 if processing succeeded, 0 if no more entries, negative on error
+ * @param rec The INGEST_UNIT record of the unit
  */
-static int bus_update_service_entry(sd_bus_message *reply, struct bus_state *st, uint64_t now)
+static void bus_update_service_entry(struct bus_state *st, ingest_record *rec)
 {
-
     Service *svc = NULL;
-    int rc = 0;
     bool is_new = false;
-    const char *unit, *load, *active, *sub, *description, *object;
-    char unit_file_state[32] = {0};
-    ;
-
-    rc = sd_bus_message_read(reply, "(ssssssouso)",
-                             &unit,
-                             &description,
-                             &load,
-                             &active,
-                             &sub,
-                             NULL,
-                             &object,
-                             NULL,
-                             NULL,
-                             NULL);
-    if (rc < 0)
-        sm_err_set("Cannot ready service from service list: %s", strerror(-rc));
-
-    /* There are no more entries in the list */
-    if (rc == 0)
-        goto fin;
+    bool described = false;
+    const char *load, *active, *sub, *file_state;
+    const char *description = rec->description, *object = rec->object;
 
-    /* Find a matching service in our existing list, or if none found create a new record */
-    svc = service_get_name(st, unit);
+    /* Find a matching listed or stale service, or if none found create a new record */
+    svc = service_get_name(st, rec->unit);
     if (!svc)
     {
         is_new = true;
-        svc = service_init(unit);
+        svc = service_init(rec->unit);
     }
 
     if (!svc)
         sm_err_set("Failed to acquire a service entry: %s", strerror(errno));
 
-    svc->last_update = now;
-    bus_unit_property(st, object, SD_IFACE("Unit"), "UnitFileState", "s", unit_file_state, 32);
+    svc->generation = st->generation;
 
-    /* Properties we detect for changes */
-    if (!svc->load || strcmp(svc->load, load))
+    /* Properties we detect for changes, states are atoms and compare by pointer */
+    load = service_atom(rec->load);
+    active = service_atom(rec->active);
+    sub = service_atom(rec->sub);
+    file_state = service_atom(rec->file_state);
+    if (!load || !active || !sub || !file_state)
+        sm_err_set("Failed to update unit states");
+
+    if (svc->load != load)
+        svc->changed++;
+    if (svc->active != active)
         svc->changed++;
-    if (!svc->active || strcmp(svc->active, active))
+    if (svc->sub != sub)
         svc->changed++;
-    if (!svc->sub || strcmp(svc->sub, sub))
+    if (svc->unit_file_state != file_state)
         svc->changed++;
-    if (!svc->unit_file_state || strcmp(svc->unit_file_state, unit_file_state))
+    if (svc->cached)
         svc->changed++;
+    svc->cached = false;
+    described = svc->description && strcmp(svc->description, description) == 0;
 
     /* Properties we just update, but dont indicate change */
-    BUS_CPY_PROPERTY(svc, unit);
-    BUS_CPY_PROPERTY(svc, load);
-    BUS_CPY_PROPERTY(svc, active);
-    BUS_CPY_PROPERTY(svc, sub);
-    BUS_CPY_PROPERTY(svc, description);
-    BUS_CPY_PROPERTY(svc, object);
-    BUS_CPY_PROPERTY(svc, unit_file_state);
+    svc->load = load;
+    service_set_active(st, svc, active);
+    svc->sub = sub;
+    svc->unit_file_state = file_state;
+    if (!described)
+        BUS_CPY_PROPERTY(svc, description);
+    if (is_new)
+        BUS_CPY_PROPERTY(svc, object);
+
+    if (!described)
+        service_update_search_keys(st, svc);
+
+    if (svc->changed || !described)
+    {
+        filter_invalidate(svc);
+        snapshot_touch(st, svc);
+    }
 
     if (svc->changed)
     {
@@ -275,191 +200,92 @@ static int bus_update_service_entry(sd_bus_message *reply, struct bus_state *st,
         svc->changed = 0;
     }
 
-    if (!is_new)
-    {
-        rc = 1;
-        goto fin;
-    }
-
-    /* Register interest in events on this object */
-    rc = sd_bus_match_signal(st->bus,
-                             &svc->slot,
-                             SD_DESTINATION,
-                             object,
-                             "org.freedesktop.DBus.Properties",
-                             "PropertiesChanged",
-                             bus_unit_changed,
-                             (void *)svc);
-    if (rc < 0)
-        sm_err_set("Cannot register interest changed units: %s\n", strerror(-rc));
-
-    // bus_update_unit_file_state(st, svc);
-    service_insert(st, svc);
-    rc = 1;
-
-fin:
-    return rc;
+    if (!svc->listed)
+        service_insert(st, svc);
 }
 
 /**
- * Retrieves all systemd services/units from the system via D-Bus.
+ * Applies one record of the ingestion thread.
  *
- * This function:
- * 1. Makes a D-Bus call to systemd's ListUnits method
- * 2. Processes the returned array of unit information
- * 3. Updates or creates service entries for each unit
- * 4. Removes services that are no longer present
- *
- * @param st Pointer to bus_state structure containing the D-Bus connection
- * @return 0 on success, negative value on error
+ * @param rec The record to apply.
+ * @return true if the units of the bus changed, false otherwise.
  */
-static int bus_get_all_systemd_services(struct bus_state *st)
-{
-    sd_bus_error error = SD_BUS_ERROR_NULL;
-    sd_bus_message *reply = NULL;
-    int rc = 0;
-    uint64_t now = service_now();
-
-    sd_bus_ref(st->bus);
-
-    rc = sd_bus_call_method(st->bus,
-                            SD_DESTINATION,
-                            SD_OPATH,
-                            SD_IFACE("Manager"),
-                            "ListUnits",
-                            &error,
-                            &reply,
-                            NULL);
-    if (rc < 0)
-    {
-        sm_err_set("Cannot call DBUS request to fetch all units: %s", strerror(-rc));
-        goto fin;
-    }
-
-    if (sd_bus_error_is_set(&error))
-    {
-        sm_err_set("Error retrieving unit list from DBUS: %s", error.message);
-        rc = -1;
-        goto fin;
-    }
-
-    rc = sd_bus_message_enter_container(reply, 'a', "(ssssssouso)");
-    if (rc < 0)
-    {
-        sm_err_set("Cannot enter into array fetching all units: %s", strerror(-rc));
-        goto fin;
-    }
-
-    while (true)
-    {
-        rc = bus_update_service_entry(reply, st, now);
-        if (rc <= 0)
-            break;
-    }
-    sd_bus_message_exit_container(reply);
-
-    services_prune_dead_units(st, now);
-
-fin:
-    sd_bus_message_unref(reply);
-    sd_bus_unref(st->bus);
-    return rc;
-}
-
-// Callback which is invoked when a reload event is captured
-static int bus_systemd_reloaded(sd_bus_message *reply, void *data, sd_bus_error *err)
+static bool bus_apply_record(ingest_record *rec)
 {
-    // This line here is a bug. Reload should be tracked in the services list
-    int rc;
-    struct bus_state *st = (struct bus_state *)data;
-
-    if (sd_bus_error_is_set(err))
-    {
-        sm_err_set("Remove unit callback failed: %s\n", err->message);
-        return -1;
-    }
+    Bus *st = &state[rec->bus];
 
-    rc = sd_bus_message_read(reply, "b", &st->reloading);
-    if (rc < 0)
+    switch (rec->kind)
     {
-        sm_err_set("Cannot read dbus mesasge: %s\n", strerror(-rc));
-        return -1;
+    case INGEST_LISTING:
+        /* Units are marked with the generation of the listing that saw them */
+        if (rec->flag)
+            st->generation++;
+        return false;
+
+    case INGEST_UNIT:
+        bus_update_service_entry(st, rec);
+        return true;
+
+    case INGEST_LISTED:
+        if (rec->flag)
+            services_sweep(st);
+        return true;
+
+    case INGEST_CHANGED:
+        return bus_unit_changed(st, rec);
+
+    case INGEST_RELOADING:
+        st->reloading = rec->flag;
+        return false;
     }
 
-    // Reload daemon services for specific bus type and conditionally redraw screen)
-    // The reload emits a boolean if it starts set to true, once the reload finishes
-    // the callback emits again, with the boolean set to false
-    if (st->reloading)
-        goto fin;
-
-    rc = bus_get_all_systemd_services(st);
-    if (rc < 0)
-        sm_err_set("Cannot reload system units: %s\n", strerror(-rc));
-
-    // If the affected bus is the one being shown
-    if (((st->type == SYSTEM) && display_bus_type() == SYSTEM) || ((st->type != SYSTEM) && display_bus_type() != SYSTEM))
-        display_redraw(st);
-
-fin:
-    sd_bus_error_free(err);
-    return 0;
+    return false;
 }
 
 /**
- * Sets up D-Bus connection and event subscriptions for a systemd bus.
+ * Callback which is invoked when the ingestion thread queued records.
  *
- * This function:
- * 1. Subscribes to systemd D-Bus events using the Manager.Subscribe method
- * 2. Sets up a signal match for the "Reloading" event from systemd
- * 3. Registers bus_systemd_reloaded as the callback for reload events
+ * Applies the records queued so far and redraws once for all of them.
+ * Records queued meanwhile wait for the next wakeup, so a busy bus cannot
+ * keep the loop from reading keys.
  *
- * @param st Pointer to bus_state structure containing the D-Bus connection
- * @return 0 on success, negative value on error
+ * @param s The event source.
+ * @param fd The descriptor of the ingestion queue.
+ * @param revents The events that occurred.
+ * @param data Unused.
+ * @return 0 on success.
  */
-static int bus_setup_bus(struct bus_state *st)
+static int bus_ingest_ready(sd_event_source *s, int fd, uint32_t revents, void *data)
 {
-    sd_bus_error error = SD_BUS_ERROR_NULL;
-    int rc = 0;
+    uint64_t wakeups;
+    uint32_t pending;
+    const char *failure;
+    bool redraw = false;
 
-    // Now subscribe to events in systemd
-    rc = sd_bus_call_method(st->bus,
-                            SD_DESTINATION,
-                            SD_OPATH,
-                            SD_IFACE("Manager"),
-                            "Subscribe",
-                            &error,
-                            NULL,
-                            NULL);
-    if (rc < 0)
-    {
-        sm_err_set("Cannot subcribe to systemd dbus events: %s\n", strerror(-rc));
-        goto fin;
-    }
+    (void)s;
+    (void)revents;
+    (void)data;
 
-    if (sd_bus_error_is_set(&error))
-    {
-        sm_err_set("Cannot subcribe to systemd dbus events: %s\n", error.message);
-        goto fin;
-    }
+    if (read(fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+        sm_err_set("Cannot read unit updates: %s\n", strerror(errno));
 
-    // We care about the reloading signal/event
-    rc = sd_bus_match_signal(st->bus,
-                             NULL,
-                             SD_DESTINATION,
-                             SD_OPATH,
-                             SD_IFACE("Manager"),
-                             "Reloading",
-                             bus_systemd_reloaded,
-                             (void *)st);
-    if (rc < 0)
+    failure = ingest_failure();
+    if (failure)
+        sm_err_set("%s\n", failure);
+
+    pending = ingest_pending();
+    while (pending--)
     {
-        sm_err_set("Cannot register interest in daemon reloads: %s\n", strerror(-rc));
-        goto fin;
+        ingest_record *rec = ingest_pop();
+
+        if (bus_apply_record(rec) && rec->bus == bus_currently_displayed()->type)
+            redraw = true;
+        free(rec);
     }
 
-fin:
-    sd_bus_error_free(&error);
-    return rc;
+    if (redraw)
+        display_refresh(bus_currently_displayed());
+    return 0;
 }
 
 /**
@@ -505,7 +331,12 @@ void bus_update_unit_file_state(Bus *bus, Service *svc)
     if (rc < 0)
         sm_err_set("Bad response reading message reply: %s\n", strerror(-rc));
 
-    BUS_CPY_PROPERTY(svc, unit_file_state);
+    unit_file_state = service_atom(unit_file_state);
+    if (!unit_file_state)
+        sm_err_set("Failed to update unit_file_state property");
+    svc->unit_file_state = unit_file_state;
+    filter_invalidate(svc);
+    snapshot_touch(bus, svc);
 
 fin:
     sd_bus_unref(bus->bus);
@@ -513,21 +344,34 @@ fin:
     sd_bus_error_free(&error);
 }
 
+/* With lazy_unit_types only the type shown at startup is listed, other
+ * types follow once they are viewed */
+static uint32_t bus_initial_types(void)
+{
+    if (!lazy_unit_types || display_mode() == ALL)
+        return BUS_ALL_TYPES;
+    return BUS_TYPE(display_mode());
+}
+
 /**
  * Initializes system and user D-Bus connections for systemd communication.
  *
  * This function:
  * 1. Sets up the system-wide systemd D-Bus connection
  *    - Initializes the bus connection
- *    - Sets up event handling and subscriptions
- *    - Fetches initial list of system services
+ *    - Sets up event handling
  *
  * 2. Sets up the user systemd D-Bus connection (if available)
  *    - Initializes the bus connection
- *    - Sets up event handling and subscriptions
- *    - Fetches initial list of user services
+ *    - Sets up event handling
  *    - Sets system_only flag if user bus is unavailable
  *
+ *    With unit_cache, either bus starts out with the units of its cache file.
+ *
+ * 3. Starts the ingestion thread, which lists the units and follows their
+ *    changes on connections of its own, and applies its records as they
+ *    arrive. These connections are kept for operations and status queries.
+ *
  * @return 0 on success, negative value on error
  */
 int bus_init(void)
@@ -552,10 +396,11 @@ int bus_init(void)
     }
 
     sys->type = SYSTEM;
+    sys->types_fetched = bus_initial_types();
     TAILQ_INIT(&sys->services);
-    rc = bus_setup_bus(sys);
-    if (rc < 0)
-        goto fin;
+    TAILQ_INIT(&sys->stale);
+    if (unit_cache)
+        cache_load(sys);
     sd_bus_ref(sys->bus);
 
     rc = sd_bus_attach_event(sys->bus, ev, SD_EVENT_PRIORITY_NORMAL);
@@ -565,17 +410,12 @@ int bus_init(void)
         goto fin;
     }
 
-    rc = bus_get_all_systemd_services(sys);
-    if (rc < 0)
-        goto fin;
-
     /* Optionally do the user systemd instance */
     rc = sd_bus_default_user(&user->bus);
     if (-rc == ENOMEDIUM)
     {
         system_only = true;
-        rc = 0;
-        goto fin;
+        goto ingest;
     }
     else if (rc < 0)
     {
@@ -585,10 +425,11 @@ int bus_init(void)
 
     system_only = false;
     user->type = USER;
+    user->types_fetched = bus_initial_types();
     TAILQ_INIT(&user->services);
-    rc = bus_setup_bus(user);
-    if (rc < 0)
-        goto fin;
+    TAILQ_INIT(&user->stale);
+    if (unit_cache)
+        cache_load(user);
     sd_bus_ref(user->bus);
 
     rc = sd_bus_attach_event(user->bus, ev, SD_EVENT_PRIORITY_NORMAL);
@@ -598,9 +439,20 @@ int bus_init(void)
         goto fin;
     }
 
-    rc = bus_get_all_systemd_services(user);
+ingest:
+    rc = ingest_start(INGEST_BUS(SYSTEM) | (system_only ? 0 : INGEST_BUS(USER)), bus_initial_types());
     if (rc < 0)
+    {
+        sm_err_set("Cannot start reading units: %s\n", strerror(-rc));
         goto fin;
+    }
+
+    rc = sd_event_add_io(ev, NULL, rc, EPOLLIN, bus_ingest_ready, NULL);
+    if (rc < 0)
+    {
+        sm_err_set("Cannot initialize event handler: %s\n", strerror(-rc));
+        goto fin;
+    }
 
 fin:
     sd_event_unref(ev);
@@ -609,6 +461,50 @@ fin:
     return rc;
 }
 
+/**
+ * Makes sure the units of a type have been listed.
+ *
+ * Without lazy_unit_types every type is listed from the start and this
+ * does nothing. Otherwise the first call for a type asks the ingestion
+ * thread for its units, ALL asks for every type not listed yet. The units
+ * show up once the thread has listed them.
+ *
+ * @param bus The bus to list the units of
+ * @param type The type about to be shown
+ * @return 0 on success, negative value on error
+ */
+int bus_fetch_type(Bus *bus, enum service_type type)
+{
+    uint32_t wanted = type == ALL || type >= UNKNOWN ? BUS_ALL_TYPES : BUS_TYPE(type);
+    uint32_t missing = wanted & ~bus->types_fetched;
+
+    if (!missing || !bus->bus)
+        return 0;
+
+    bus->types_fetched |= missing;
+
+    // All types go through ListUnits, as units of unknown types have no glob
+    ingest_request_types(bus->type, wanted == BUS_ALL_TYPES ? BUS_ALL_TYPES : missing);
+    return 0;
+}
+
+/**
+ * Writes the units of both buses to their cache files, if unit_cache is
+ * set. Called when quitting, failures only cost the next start its head
+ * start and are ignored.
+ */
+void bus_save_cache(void)
+{
+    if (!unit_cache)
+        return;
+
+    for (int i = SYSTEM; i <= USER; i++)
+    {
+        if (state[i].bus)
+            cache_save(&state[i]);
+    }
+}
+
 /**
  * Returns whether only system bus is available.
  *
@@ -649,8 +545,12 @@ int bus_invocation_id(Bus *bus, Service *svc)
     size_t len = 0;
     int rc = 0;
     char *ptr = NULL;
+    service_detail *d = service_detail_get(svc);
     size_t remaining = 32; /* Max length of invocation_id is 32 chars + 1 null terminator */
 
+    if (!d)
+        return -ENOMEM;
+
     rc = sd_bus_get_property(bus->bus,
                              SD_DESTINATION,
                              svc->object,
@@ -682,11 +582,11 @@ int bus_invocation_id(Bus *bus, Service *svc)
     if (len != 16)
     {
         rc = -1;
-        strncpy(svc->invocation_id, "00000000000000000000000000000000", 33);
+        strncpy(d->invocation_id, "00000000000000000000000000000000", 33);
         goto fin;
     }
 
-    ptr = svc->invocation_id;
+    ptr = d->invocation_id;
     for (size_t i = 0; i < len && remaining > 0; i++)
     {
         int written = snprintf(ptr, remaining + 1, "%02hhx", id[i]);
@@ -695,7 +595,7 @@ int bus_invocation_id(Bus *bus, Service *svc)
         {
             /* write error */
             sm_err_set("Failed to write invocation ID");
-            strncpy(svc->invocation_id, "00000000000000000000000000000000", 33);
+            strncpy(d->invocation_id, "00000000000000000000000000000000", 33);
             rc = -1;
             goto fin;
         }
@@ -735,37 +635,45 @@ fin:
  */
 void bus_fetch_service_status(Bus *bus, Service *svc)
 {
+    service_detail *d = NULL;
+
+    // Start from a fresh detail block so strings of an earlier fetch are released
+    service_detail_free(svc);
+    d = service_detail_get(svc);
+    if (!d)
+        sm_err_set("Cannot allocate status details for %s", svc->unit);
+
     bus_invocation_id(bus, svc);
-    bus_unit_property(bus, svc->object, SD_IFACE("Unit"), "FragmentPath", "s", &svc->fragment_path, 0);
+    bus_unit_property(bus, svc->object, SD_IFACE("Unit"), "FragmentPath", "s", &d->fragment_path, 0);
 
     switch (svc->type)
     {
     case SERVICE:
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "ExecMainStartTimestamp", "t", &svc->exec_main_start, sizeof(svc->exec_main_start));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "ExecMainPID", "u", &svc->main_pid, sizeof(svc->main_pid));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "TasksCurrent", "t", &svc->tasks_current, sizeof(svc->tasks_current));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "TasksMax", "t", &svc->tasks_max, sizeof(svc->tasks_max));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemoryCurrent", "t", &svc->memory_current, sizeof(svc->memory_current));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemoryPeak", "t", &svc->memory_peak, sizeof(svc->memory_peak));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemorySwapCurrent", "t", &svc->swap_current, sizeof(svc->swap_current));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemorySwapPeak", "t", &svc->swap_peak, sizeof(svc->swap_peak));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemoryZSwapCurrent", "t", &svc->zswap_current, sizeof(svc->zswap_current));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "CPUUsageNSec", "t", &svc->cpu_usage, sizeof(svc->cpu_usage));
-        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "ControlGroup", "s", &svc->cgroup, 0);
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "ExecMainStartTimestamp", "t", &d->u.service.exec_main_start, sizeof(d->u.service.exec_main_start));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "ExecMainPID", "u", &d->u.service.main_pid, sizeof(d->u.service.main_pid));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "TasksCurrent", "t", &d->u.service.tasks_current, sizeof(d->u.service.tasks_current));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "TasksMax", "t", &d->u.service.tasks_max, sizeof(d->u.service.tasks_max));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemoryCurrent", "t", &d->u.service.memory_current, sizeof(d->u.service.memory_current));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemoryPeak", "t", &d->u.service.memory_peak, sizeof(d->u.service.memory_peak));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemorySwapCurrent", "t", &d->u.service.swap_current, sizeof(d->u.service.swap_current));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemorySwapPeak", "t", &d->u.service.swap_peak, sizeof(d->u.service.swap_peak));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "MemoryZSwapCurrent", "t", &d->u.service.zswap_current, sizeof(d->u.service.zswap_current));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "CPUUsageNSec", "t", &d->u.service.cpu_usage, sizeof(d->u.service.cpu_usage));
+        bus_unit_property(bus, svc->object, SD_IFACE("Service"), "ControlGroup", "s", &d->u.service.cgroup, 0);
         break;
     case DEVICE:
-        bus_unit_property(bus, svc->object, SD_IFACE("Device"), "SysFSPath", "s", &svc->sysfs_path, 0);
+        bus_unit_property(bus, svc->object, SD_IFACE("Device"), "SysFSPath", "s", &d->u.device.sysfs_path, 0);
         break;
     case MOUNT:
-        bus_unit_property(bus, svc->object, SD_IFACE("Mount"), "Where", "s", &svc->mount_where, 0);
-        bus_unit_property(bus, svc->object, SD_IFACE("Mount"), "What", "s", &svc->mount_what, 0);
+        bus_unit_property(bus, svc->object, SD_IFACE("Mount"), "Where", "s", &d->u.mount.where, 0);
+        bus_unit_property(bus, svc->object, SD_IFACE("Mount"), "What", "s", &d->u.mount.what, 0);
         break;
     case TIMER:
-        bus_unit_property(bus, svc->object, SD_IFACE("Timer"), "NextElapseUSecRealtime", "t", &svc->next_elapse, sizeof(svc->next_elapse));
+        bus_unit_property(bus, svc->object, SD_IFACE("Timer"), "NextElapseUSecRealtime", "t", &d->u.timer.next_elapse, sizeof(d->u.timer.next_elapse));
         break;
     case SOCKET:
-        bus_unit_property(bus, svc->object, SD_IFACE("Socket"), "BindIPv6Only", "s", &svc->bind_ipv6_only, 0);
-        bus_unit_property(bus, svc->object, SD_IFACE("Socket"), "Backlog", "u", &svc->backlog, sizeof(svc->backlog));
+        bus_unit_property(bus, svc->object, SD_IFACE("Socket"), "BindIPv6Only", "s", &d->u.socket.bind_ipv6_only, 0);
+        bus_unit_property(bus, svc->object, SD_IFACE("Socket"), "Backlog", "u", &d->u.socket.backlog, sizeof(d->u.socket.backlog));
         break;
     case PATH:
         break;
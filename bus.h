@@ -4,13 +4,17 @@
 #include <systemd/sd-bus.h>
 typedef struct bus_state Bus;
 #include "service.h"
+#include "trigram.h"
+#include "pool.h"
 #define SD_DESTINATION "org.freedesktop.systemd1"
 #define SD_IFACE(x) "org.freedesktop.systemd1." x
 #define SD_OPATH "/org/freedesktop/systemd1"
+#define BUS_TYPE(t) (1u << (t))
+#define BUS_ALL_TYPES (BUS_TYPE(MAX_TYPES) - 1)
 #define BUS_CPY_PROPERTY(svc, src)                            \
     {                                                         \
-        free(svc->src);                                       \
-        svc->src = strdup(src);                               \
+        pool_strfree(svc->src);                               \
+        svc->src = pool_strdup(src);                          \
         if (!svc->src)                                        \
             sm_err_set("Failed to update %s property", #src); \
     }
@@ -23,13 +27,25 @@ struct bus_state
 {
     enum bus_type type;
     bool reloading;
+    unsigned long revision; // Bumped whenever units are added, removed or reordered
     sd_bus *bus;
+    uint32_t generation; // Bumped for every full listing of the units
     int total_types[MAX_TYPES];
+    int total_states[MAX_STATES];
+    uint32_t types_fetched; // A bit per service_type listed so far
     service_list services;
+    service_list stale; // Units missing from the last listing
+    Service **names;    // Listed and stale units by name, chained by name_next
+    uint32_t names_size;
+    uint32_t names_count;
+    trigram_index trigrams;
+    struct unit_snapshot *snapshot; // Units as last published for readers, see snapshot.h
 };
 Bus *bus_currently_displayed(void);
 bool bus_system_only(void);
 int bus_init(void);
+int bus_fetch_type(Bus *bus, enum service_type type);
+void bus_save_cache(void);
 int bus_invocation_id(Bus *bus, Service *svc);
 int bus_operation(Bus *bus, Service *svc, enum operation op);
 void bus_fetch_service_status(Bus *bus, Service *svc);
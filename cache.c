@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sm_err.h"
+#include "config.h"
+#include "cache.h"
+
+/* Distinct state strings written per file, states are atoms so a handful */
+#define CACHE_ATOMS 256
+
+/* Distinct state strings a file may hold to be read, systemd knows about 60 */
+#define CACHE_STATES 96
+
+/* A string table being written, states are stored once each */
+struct cache_strings
+{
+    char *data;
+    size_t len;
+    size_t size;
+    const char *atoms[CACHE_ATOMS];
+    uint32_t atom_offsets[CACHE_ATOMS];
+};
+
+/**
+ * Builds the path of the cache file of a bus for the effective user.
+ *
+ * Files live in $XDG_CACHE_HOME/servicemaster, or ~/.cache/servicemaster,
+ * one per bus and uid as the units seen differ by both.
+ *
+ * @param bus The bus the units belong to.
+ * @param path Receives the path.
+ * @param dir Receives the directory of the path, may be NULL.
+ * @return 0 on success, -ENOENT if there is no place for a cache.
+ */
+static int cache_path(Bus *bus, char path[PATH_MAX], char dir[PATH_MAX])
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char base[PATH_MAX];
+    int n;
+
+    if (xdg && *xdg == '/')
+        n = snprintf(base, PATH_MAX, "%s/servicemaster", xdg);
+    else if (home && *home == '/')
+        n = snprintf(base, PATH_MAX, "%s/.cache/servicemaster", home);
+    else
+        return -ENOENT;
+    if (n >= PATH_MAX)
+        return -ENAMETOOLONG;
+
+    if (dir)
+        strcpy(dir, base);
+
+    n = snprintf(path, PATH_MAX, "%s/%s-%u.units", base, bus->type == SYSTEM ? "system" : "user", (unsigned)geteuid());
+    return n >= PATH_MAX ? -ENAMETOOLONG : 0;
+}
+
+/* Checks an offset points at a string of the table */
+static const char *cache_string(const char *strings, uint32_t size, uint32_t offset)
+{
+    return offset < size ? strings + offset : NULL;
+}
+
+/* A state as systemd names them, lowercase words joined by dashes, or empty */
+static bool cache_state_valid(const char *state)
+{
+    size_t len = strlen(state);
+
+    return len < 32 && strspn(state, "abcdefghijklmnopqrstuvwxyz0123456789-") == len;
+}
+
+/**
+ * Checks the states of all units of a file before any is interned.
+ *
+ * Atoms are never freed and their table is small, so a damaged or foreign
+ * file must not leave its strings there or use up the table.
+ *
+ * @return true if every state offset is valid and looks like a state, and
+ * there are at most CACHE_STATES distinct ones.
+ */
+static bool cache_states_valid(const cache_unit *units, uint32_t count, const char *strings, uint32_t size)
+{
+    uint32_t seen[CACHE_STATES];
+    int nseen = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint32_t offsets[] = {units[i].load, units[i].active, units[i].sub, units[i].unit_file_state};
+
+        for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
+        {
+            const char *state = cache_string(strings, size, offsets[o]);
+            int k = 0;
+
+            while (k < nseen && seen[k] != offsets[o])
+                k++;
+            if (k < nseen)
+                continue;
+
+            if (!state || !cache_state_valid(state) || nseen == CACHE_STATES)
+                return false;
+            seen[nseen++] = offsets[o];
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Fills a bus with the units of its cache file.
+ *
+ * The units are shown until the first listing of the bus confirms them.
+ * They are marked as cached until then, units missing from that listing
+ * are swept like any other. Units of types not listed yet and excluded
+ * units are skipped. A missing or damaged file is no error, the bus then
+ * starts empty as without a cache.
+ *
+ * @param bus The empty bus to fill.
+ * @return The number of units read.
+ */
+int cache_load(Bus *bus)
+{
+    char path[PATH_MAX];
+    const cache_header *hdr = NULL;
+    const cache_unit *units = NULL;
+    const char *strings = NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    int fd = -1, loaded = 0;
+
+    if (cache_path(bus, path, NULL) < 0)
+        return 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(cache_header))
+        goto fin;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        goto fin;
+
+    hdr = map;
+    if (hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION)
+        goto fin;
+
+    // The sizes must add up exactly and the table must end a string
+    if ((uint64_t)st.st_size != sizeof(cache_header) + (uint64_t)hdr->count * sizeof(cache_unit) + hdr->strings)
+        goto fin;
+    if (hdr->strings == 0)
+        goto fin;
+
+    units = (const cache_unit *)(hdr + 1);
+    strings = (const char *)(units + hdr->count);
+    if (strings[hdr->strings - 1] != '\0')
+        goto fin;
+    if (!cache_states_valid(units, hdr->count, strings, hdr->strings))
+        goto fin;
+
+    for (uint32_t i = 0; i < hdr->count; i++)
+    {
+        const cache_unit *cu = &units[i];
+        const char *unit = cache_string(strings, hdr->strings, cu->unit);
+        const char *description = cache_string(strings, hdr->strings, cu->description);
+        const char *object = cache_string(strings, hdr->strings, cu->object);
+        const char *load = cache_string(strings, hdr->strings, cu->load);
+        const char *active = cache_string(strings, hdr->strings, cu->active);
+        const char *sub = cache_string(strings, hdr->strings, cu->sub);
+        const char *file_state = cache_string(strings, hdr->strings, cu->unit_file_state);
+        Service *svc;
+
+        if (!unit || !description || !object || !load || !active || !sub || !file_state)
+            break;
+
+        if (!(bus->types_fetched & BUS_TYPE(service_type_of(unit))) || config_unit_excluded(unit))
+            continue;
+
+        // A unit may be cached twice if the file was written by hand
+        if (service_get_name(bus, unit))
+            continue;
+
+        // States were checked, but the atoms may still run out or memory
+        load = service_atom(load);
+        active = service_atom(active);
+        sub = service_atom(sub);
+        file_state = service_atom(file_state);
+        if (!load || !active || !sub || !file_state)
+            break;
+
+        svc = service_init(unit);
+        if (!svc)
+            sm_err_set("Failed to acquire a service entry: %s", strerror(errno));
+
+        svc->load = load;
+        svc->active = active;
+        svc->sub = sub;
+        svc->unit_file_state = file_state;
+
+        BUS_CPY_PROPERTY(svc, description);
+        BUS_CPY_PROPERTY(svc, object);
+        service_update_search_keys(bus, svc);
+
+        svc->cached = true;
+        service_insert(bus, svc);
+        loaded++;
+    }
+
+fin:
+    if (map != MAP_FAILED)
+        munmap(map, st.st_size);
+    if (fd >= 0)
+        close(fd);
+    return loaded;
+}
+
+/* Appends a string to the table, returning its offset */
+static int cache_strings_add(struct cache_strings *t, const char *str, uint32_t *offset)
+{
+    size_t len = strlen(str) + 1;
+
+    if (t->len + len > t->size)
+    {
+        size_t size = t->size ? t->size * 2 : 65536;
+        char *data;
+
+        while (size < t->len + len)
+            size *= 2;
+        if (size > UINT32_MAX)
+            return -E2BIG;
+
+        data = realloc(t->data, size);
+        if (!data)
+            return -ENOMEM;
+        t->data = data;
+        t->size = size;
+    }
+
+    memcpy(t->data + t->len, str, len);
+    *offset = t->len;
+    t->len += len;
+    return 0;
+}
+
+/* Appends a state once per file, later uses share the first copy */
+static int cache_strings_atom(struct cache_strings *t, const char *atom, uint32_t *offset)
+{
+    uint32_t slot = (uint32_t)(((uintptr_t)atom >> 4) % CACHE_ATOMS);
+
+    for (int i = 0; i < CACHE_ATOMS; i++, slot = (slot + 1) % CACHE_ATOMS)
+    {
+        if (t->atoms[slot] == atom)
+        {
+            *offset = t->atom_offsets[slot];
+            return 0;
+        }
+
+        if (!t->atoms[slot])
+        {
+            int rc = cache_strings_add(t, atom, offset);
+
+            if (rc == 0)
+            {
+                t->atoms[slot] = atom;
+                t->atom_offsets[slot] = *offset;
+            }
+            return rc;
+        }
+    }
+
+    return cache_strings_add(t, atom, offset);
+}
+
+/**
+ * Writes the units of a bus to its cache file.
+ *
+ * Nothing is written while units read from the cache are not confirmed
+ * by a listing yet, quitting early leaves the previous file in place. The
+ * file is replaced atomically, readers never see a partial one.
+ *
+ * @param bus The bus to write the units of.
+ * @return 0 on success, negative error code on failure.
+ */
+int cache_save(Bus *bus)
+{
+    char path[PATH_MAX], dir[PATH_MAX], tmp[PATH_MAX + 8];
+    struct cache_strings strings = {0};
+    cache_header hdr = {CACHE_MAGIC, CACHE_VERSION, 0, 0};
+    cache_unit *units = NULL;
+    Service *svc;
+    FILE *fp = NULL;
+    int rc;
+
+    rc = cache_path(bus, path, dir);
+    if (rc < 0)
+        return rc;
+
+    units = malloc((bus->total_types[ALL] + 1) * sizeof(cache_unit));
+    if (!units)
+        return -ENOMEM;
+
+    TAILQ_FOREACH(svc, &bus->services, e)
+    {
+        cache_unit *cu = &units[hdr.count];
+
+        if (svc->cached)
+            goto fin;
+
+        rc = cache_strings_add(&strings, svc->unit, &cu->unit);
+        if (rc == 0)
+            rc = cache_strings_add(&strings, svc->description ? svc->description : "", &cu->description);
+        if (rc == 0)
+            rc = cache_strings_add(&strings, svc->object, &cu->object);
+        if (rc == 0)
+            rc = cache_strings_atom(&strings, svc->load, &cu->load);
+        if (rc == 0)
+            rc = cache_strings_atom(&strings, svc->active, &cu->active);
+        if (rc == 0)
+            rc = cache_strings_atom(&strings, svc->sub, &cu->sub);
+        if (rc == 0)
+            rc = cache_strings_atom(&strings, svc->unit_file_state ? svc->unit_file_state : "", &cu->unit_file_state);
+        if (rc < 0)
+            goto fin;
+
+        hdr.count++;
+    }
+
+    if (hdr.count == 0)
+        goto fin;
+    hdr.strings = strings.len;
+
+    // Create ~/.cache if needed, then our own directory
+    if (mkdir(dir, 0700) < 0 && errno == ENOENT)
+    {
+        char *slash = strrchr(dir, '/');
+
+        *slash = '\0';
+        mkdir(dir, 0700);
+        *slash = '/';
+        mkdir(dir, 0700);
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.new", path);
+    fp = fopen(tmp, "w");
+    if (!fp)
+    {
+        rc = -errno;
+        goto fin;
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(units, sizeof(cache_unit), hdr.count, fp) != hdr.count ||
+        fwrite(strings.data, 1, strings.len, fp) != strings.len)
+        rc = -EIO;
+    if (fclose(fp) != 0 && rc == 0)
+        rc = -errno;
+
+    if (rc == 0 && rename(tmp, path) < 0)
+        rc = -errno;
+    if (rc < 0)
+        unlink(tmp);
+
+fin:
+    free(strings.data);
+    free(units);
+    return rc;
+}
@@ -0,0 +1,33 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+#include <stdint.h>
+#include "bus.h"
+
+#define CACHE_MAGIC 0x554d5331 // "1SMU" in a little endian dump
+#define CACHE_VERSION 1
+
+/* Layout of a unit cache file: the header, count units, then the strings
+ * the units point into as offsets, each NUL terminated. Files are read
+ * with mmap and in host byte order, they never leave the machine. */
+typedef struct cache_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;   // Number of cache_unit entries
+    uint32_t strings; // Size of the string table
+} cache_header;
+
+typedef struct cache_unit
+{
+    uint32_t unit;
+    uint32_t description;
+    uint32_t object;
+    uint32_t load;
+    uint32_t active;
+    uint32_t sub;
+    uint32_t unit_file_state;
+} cache_unit;
+
+int cache_load(Bus *bus);
+int cache_save(Bus *bus);
+#endif
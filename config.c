@@ -1,6 +1,8 @@
 #include "config.h"
 #include <signal.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <fnmatch.h>
 
 // External function to reset the terminal window title
 extern void reset_terminal_title(void);
@@ -10,48 +12,61 @@ char *actual_scheme = NULL;
 ColorScheme *color_schemes = NULL;
 int scheme_count = 0;
 
+// Units never to be tracked
+ExcludePattern *exclude_patterns = NULL;
+int exclude_count = 0;
+
+// List unit types only once they are viewed
+bool lazy_unit_types = false;
+
+// Show the units of the last run until systemd listed them
+bool unit_cache = false;
+
 // Array of color names for validation
 const char *color_names[NUM_COLORS] = {
     "black", "white", "green", "yellow",
     "red", "magenta", "cyan", "blue"};
 
+// The ncurses color of each name above
+static const short color_numbers[NUM_COLORS] = {
+    COLOR_BLACK, COLOR_WHITE, COLOR_GREEN, COLOR_YELLOW,
+    COLOR_RED, COLOR_MAGENTA, COLOR_CYAN, COLOR_BLUE};
+
 /**
- * Signal handler for cleaning up resources before program termination.
+ * Signal handler for signals that leave the program in an unknown state.
  *
- * This function is called when a termination signal is received. It performs
- * necessary cleanup by:
- * 1. Freeing color scheme resources
- * 2. Freeing the current color scheme name
- * 3. Printing a cleanup message
- * 4. Exiting the program with the received signal number
+ * The process may have been stopped anywhere, so nothing is freed and no
+ * thread is waited for here. The handler only:
+ * 1. Restores the terminal
+ * 2. Prints a signal message
+ * 3. Exits the program with the received signal number
+ *
+ * Requests to quit (SIGINT, SIGTERM, SIGHUP) are read from the event loop
+ * instead, see display_init().
  *
  * @param signum The signal number that triggered the handler
  */
 void cleanup_handler(int signum)
 {
-    free_color_schemes();
-    free(actual_scheme);
-
     // Reset terminal settings
     reset_terminal_title();
     endwin();
     reset_shell_mode();
+    curs_set(1);
     fflush(stdout);
-    fflush(stderr);
-    fflush(stdin);
     // Print Signal message
-    printf("\nSignal: %s !\nAll memory freed. Exiting...\n\n", strsignal(signum));
-    curs_set(1);
-    // Exit with the signal number
-    exit(signum);
+    fprintf(stderr, "\nSignal: %s !\nExiting...\n\n", strsignal(signum));
+    // Exit with the signal number, without running atexit handlers
+    _exit(signum);
 }
 
 /**
- * Configures signal handlers for graceful program termination.
+ * Configures signal handlers for program faults.
  *
- * Sets up signal handlers for common termination and error signals (SIGINT, SIGTERM,
- * SIGABRT, SIGSEGV ...) to invoke the cleanup_handler, ensuring proper resource cleanup
- * before program exit.
+ * Sets up signal handlers for error signals (SIGABRT, SIGSEGV ...) to invoke
+ * the cleanup_handler, so the terminal is usable after a crash. Until
+ * display_init() routes them through the event loop, SIGINT, SIGTERM and
+ * SIGHUP keep their default action, nothing needs restoring before it.
  */
 void setup_signal_handlers()
 {
@@ -61,11 +76,8 @@ void setup_signal_handlers()
     sa.sa_flags = 0;
 
     // Setup signal handlers
-    sigaction(SIGINT, &sa, NULL);  // Interrupt signal from keyboard
-    sigaction(SIGTERM, &sa, NULL); // Terminate signal from kill(1)
     sigaction(SIGABRT, &sa, NULL); // Abort signal from abort(3)
     sigaction(SIGSEGV, &sa, NULL); // Segmentation fault
-    sigaction(SIGHUP, &sa, NULL);  // Hangup detected
     sigaction(SIGQUIT, &sa, NULL); // Quit signal (Ctrl+\)
     sigaction(SIGILL, &sa, NULL);  // Illegal instruction
     sigaction(SIGFPE, &sa, NULL);  // Floating point exception
@@ -191,6 +203,53 @@ int parse_rgb_array(toml_array_t *arr, int *rgb, const char *color_name, const c
     return 1;
 }
 
+/**
+ * Parses the optional selection colors of a scheme.
+ *
+ * @param arr TOML array with the foreground and background color names, may be NULL
+ * @param selection Receives the ncurses colors, -1 if not given
+ * @param scheme_name Name of the color scheme (for error messages)
+ * @return 1 on success, 0 on failure
+ */
+static int parse_selection(toml_array_t *arr, short selection[2], const char *scheme_name)
+{
+    selection[0] = selection[1] = -1;
+    if (!arr)
+        return 1;
+
+    if (toml_array_nelem(arr) != 2)
+    {
+        fprintf(stderr, "Selection of scheme '%s' needs a foreground and a background color\n", scheme_name);
+        return 0;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        toml_raw_t raw = toml_raw_at(arr, i);
+        char *name = NULL;
+        int c;
+
+        if (!raw || toml_rtos(raw, &name) != 0)
+        {
+            fprintf(stderr, "Invalid selection color in scheme '%s'\n", scheme_name);
+            return 0;
+        }
+
+        for (c = 0; c < NUM_COLORS && strcmp(name, color_names[c]) != 0; c++)
+            ;
+        if (c == NUM_COLORS)
+        {
+            fprintf(stderr, "Unknown selection color '%s' in scheme '%s'\n", name, scheme_name);
+            free(name);
+            return 0;
+        }
+
+        selection[i] = color_numbers[c];
+        free(name);
+    }
+    return 1;
+}
+
 /**
  * Parses a color scheme from a TOML table configuration.
  *
@@ -201,6 +260,8 @@ int parse_rgb_array(toml_array_t *arr, int *rgb, const char *color_name, const c
  * - A "name" field containing the scheme name
  * - RGB array entries for each color: black, white, green, yellow, red, magenta, cyan, blue
  *   Each RGB array must contain exactly 3 integers (0-255)
+ * - An optional "selection" array with the foreground and background color
+ *   names of the selected row
  *
  * The parsed scheme is added to the global color_schemes array.
  * Memory is allocated for both the scheme name and the color_schemes array.
@@ -260,6 +321,12 @@ int parse_color_scheme(toml_table_t *table)
         }
     }
 
+    if (!parse_selection(toml_array_in(table, "selection"), scheme.selection, scheme.name))
+    {
+        free(scheme.name);
+        return 0;
+    }
+
     // Add to array
     ColorScheme *tmp = realloc(color_schemes, (scheme_count + 1) * sizeof(ColorScheme));
     if (!tmp)
@@ -398,3 +465,162 @@ int load_actual_scheme(const char *filename)
     toml_free(root);
     return 1;
 }
+
+/* Split a glob into the parts it is matched by */
+static void compile_exclude_pattern(ExcludePattern *ep)
+{
+    const char *star = strchr(ep->pattern, '*');
+
+    ep->glob = strpbrk(ep->pattern, "?[\\") != NULL || (star && strchr(star + 1, '*'));
+    ep->wildcard = star != NULL;
+    ep->prefix_len = star ? (size_t)(star - ep->pattern) : strlen(ep->pattern);
+    ep->suffix = star ? star + 1 : "";
+    ep->suffix_len = strlen(ep->suffix);
+}
+
+/**
+ * Loads the settings deciding which units are tracked from a TOML
+ * configuration file.
+ *
+ * @param filename Path to the TOML configuration file
+ * @return 1 on success, 0 on failure
+ *
+ * Both settings are optional:
+ * - 'exclude_units' holds unit name globs. Units matching any of them are
+ *   dropped when the unit list is read, before any memory or D-Bus signal
+ *   match is spent on them.
+ * - 'lazy_unit_types' makes systemd list only the units of the type being
+ *   viewed, other types are listed when first viewed.
+ * - 'unit_cache' keeps the units of a run in a cache file, so the next run
+ *   shows them at once while systemd lists the units.
+ *
+ * Error conditions:
+ * - File cannot be opened
+ * - TOML parsing errors
+ * - 'exclude_units' is not an array of strings
+ * - 'lazy_unit_types' is not a boolean
+ * - 'unit_cache' is not a boolean
+ */
+int load_unit_settings(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        perror("Error opening file");
+        return 0;
+    }
+
+    char errbuf[200];
+    toml_table_t *root = toml_parse_file(fp, errbuf, sizeof(errbuf));
+    fclose(fp);
+
+    if (!root)
+    {
+        fprintf(stderr, "TOML Parse error: %s\n", errbuf);
+        return 0;
+    }
+
+    toml_raw_t lazy_raw = toml_raw_in(root, "lazy_unit_types");
+    int lazy = 0;
+    if (lazy_raw && toml_rtob(lazy_raw, &lazy) != 0)
+    {
+        fprintf(stderr, "Failed to parse 'lazy_unit_types'\n");
+        toml_free(root);
+        return 0;
+    }
+    lazy_unit_types = lazy;
+
+    toml_raw_t cache_raw = toml_raw_in(root, "unit_cache");
+    int cache = 0;
+    if (cache_raw && toml_rtob(cache_raw, &cache) != 0)
+    {
+        fprintf(stderr, "Failed to parse 'unit_cache'\n");
+        toml_free(root);
+        return 0;
+    }
+    unit_cache = cache;
+
+    // Nothing is excluded unless configured
+    toml_array_t *patterns = toml_array_in(root, "exclude_units");
+    if (!patterns)
+    {
+        toml_free(root);
+        return 1;
+    }
+
+    int arr_len = toml_array_nelem(patterns);
+    exclude_patterns = calloc(arr_len ? arr_len : 1, sizeof(ExcludePattern));
+    if (!exclude_patterns)
+    {
+        fprintf(stderr, "Memory allocation failed for exclude patterns\n");
+        toml_free(root);
+        return 0;
+    }
+
+    for (int i = 0; i < arr_len; i++)
+    {
+        ExcludePattern *ep = &exclude_patterns[exclude_count];
+
+        if (toml_rtos(toml_raw_at(patterns, i), &ep->pattern) != 0)
+        {
+            fprintf(stderr, "Invalid entry %d in 'exclude_units': Not a string\n", i);
+            toml_free(root);
+            free_exclude_patterns();
+            return 0;
+        }
+
+        compile_exclude_pattern(ep);
+        exclude_count++;
+    }
+
+    toml_free(root);
+    return 1;
+}
+
+void free_exclude_patterns()
+{
+    for (int i = 0; i < exclude_count; i++)
+    {
+        free(exclude_patterns[i].pattern);
+    }
+    free(exclude_patterns);
+    exclude_patterns = NULL;
+    exclude_count = 0;
+}
+
+/**
+ * Checks a unit name against the configured exclude_units globs.
+ *
+ * @param unit The unit name
+ * @return true if the unit must not be tracked
+ */
+bool config_unit_excluded(const char *unit)
+{
+    size_t len = strlen(unit);
+
+    for (int i = 0; i < exclude_count; i++)
+    {
+        ExcludePattern *ep = &exclude_patterns[i];
+
+        if (ep->glob)
+        {
+            if (fnmatch(ep->pattern, unit, 0) == 0)
+                return true;
+            continue;
+        }
+
+        if (!ep->wildcard)
+        {
+            if (strcmp(ep->pattern, unit) == 0)
+                return true;
+            continue;
+        }
+
+        if (len >= ep->prefix_len + ep->suffix_len &&
+            strncmp(unit, ep->pattern, ep->prefix_len) == 0 &&
+            strcmp(unit + len - ep->suffix_len, ep->suffix) == 0)
+            return true;
+    }
+
+    return false;
+}
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h> // For int64_t
+#include <stdbool.h>
 #include "lib/toml.h"
 #include <ncurses.h>
 
@@ -22,9 +23,25 @@ typedef struct
     int magenta[3];
     int cyan[3];
     int blue[3];
+    short selection[2]; // Foreground and background of the selected row, -1 for the default
 } ColorScheme;
 
+/* A unit name glob from exclude_units. Globs with at most one '*' and no
+ * other wildcards are matched by comparing prefix and suffix, anything
+ * else goes through fnmatch */
+typedef struct
+{
+    char *pattern;
+    bool glob;
+    bool wildcard;
+    size_t prefix_len;
+    const char *suffix;
+    size_t suffix_len;
+} ExcludePattern;
+
 extern char *actual_scheme;
+extern bool lazy_unit_types;
+extern bool unit_cache;
 extern ColorScheme *color_schemes;
 extern int scheme_count;
 void free_color_schemes();
@@ -32,6 +49,9 @@ int parse_rgb_array(toml_array_t *arr, int *rgb, const char *color_name, const c
 int parse_color_scheme(toml_table_t *table);
 int load_color_schemes(const char *filename);
 int load_actual_scheme(const char *filename);
+int load_unit_settings(const char *filename);
+void free_exclude_patterns();
+bool config_unit_excluded(const char *unit);
 void print_file(const char *filename);
 void cleanup_handler(int signum);
 void setup_signal_handlers();
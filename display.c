@@ -1,28 +1,43 @@
+#define _GNU_SOURCE // wcwidth()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <ncurses.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <systemd/sd-event.h>
 #include <systemd/sd-bus.h>
 #include <time.h>
 #include <ctype.h>
+#include <wchar.h>
+#include <locale.h>
 #include "display.h"
 #include "service.h"
 #include "bus.h"
 #include "sm_err.h"
 #include "config.h"
+#include "journal.h"
+#include "filter.h"
+#include "sort.h"
+#include "ingest.h"
 
 // External function to reset the terminal window title
 extern void reset_terminal_title(void);
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 // Function declarations
 static void sort_services_by_header(Bus *bus);
+static void display_sort_add_header(void);
+static void display_top_talkers(Bus *bus);
+static void display_invocations(Bus *bus, Service *svc);
+static void display_merged_logs(Bus *bus, Service *svc);
+static bool display_input_window(const char *title, const char *label, char *buf, size_t size);
 
 extern char *colors[];
 
@@ -34,6 +49,10 @@ static int position = 0;
 static uid_t euid = INT32_MAX;
 static sd_event *event = NULL;
 static sd_event_source *event_source = NULL;
+// Signals read from the event loop instead of interrupting it
+static sigset_t signals;
+// Keys are read from this window, getch() on stdscr would refresh it between keys
+static WINDOW *input = NULL;
 
 // Enum for header highlighting
 typedef enum
@@ -65,6 +84,89 @@ static SortDirection active_sort_direction = SORT_ASCENDING;
 static SortDirection sub_sort_direction = SORT_ASCENDING;
 static SortDirection description_sort_direction = SORT_ASCENDING;
 
+// Incremental search, narrows the list while typing
+static service_search search;
+static bool search_active = false;
+static enum service_type search_saved_mode = SERVICE;
+static int search_saved_position = 0;
+static int search_saved_index_start = 0;
+
+// Filter expression applied on top of the type filter, NULL if none
+static filter_expr *unit_filter = NULL;
+
+/* The units in the order they are listed, after the type filter, a
+ * running search and the filter expression are applied. Rebuilt only when
+ * one of those or the units themselves change. */
+static struct
+{
+    Service **units;
+    int count;
+    int size;
+    bool valid;
+    Bus *bus;
+    unsigned long revision;
+    unsigned long changes;
+    uint32_t generation;
+    enum service_type mode;
+    sort_order order;    // Columns the units are ordered by, none for object path
+    unsigned long moves; // Bumped whenever units change their place in the view
+} view = {0};
+
+/* The units on screen, row n of the list shows view.units[index_start + n]
+ * as long as moves is the one of the view. Rows whose unit changed since
+ * the last frame are dirty, as long as no unit moved and the list did not
+ * scroll, a frame repaints only these. */
+#define D_DIRTY_MAX 256
+static struct
+{
+    bool valid; // The screen shows the view as recorded here
+    Bus *bus;
+    unsigned long moves;
+    int index_start;
+    int position;
+    int rows; // Rows of the list showing a unit
+    int ndirty;
+    bool overflow; // More rows changed than fit, repaint everything
+    int dirty[D_DIRTY_MAX];
+} screen = {0};
+
+/* Terminal geometry and what follows from it, computed once per resize.
+ * The unit columns are in D_XLOAD and the following. */
+static struct
+{
+    uint32_t id; // Bumped on every change, 0 before the screen is set up
+    int rows;
+    int cols;
+    int header_row; // Row of the column headers, the function keys take two rows on narrow terminals
+} layout = {0};
+
+/* What an attribute of the theme is used for */
+enum theme_attr
+{
+    ATTR_TEXT,       // Frame, headers and text of windows
+    ATTR_SELECTION,  // The selected row
+    ATTR_MARKED,     // Rows of marked units
+    ATTR_CACHED,     // Rows of units not listed yet
+    ATTR_SORTED,     // Headers of the sort columns
+    ATTR_COUNT,      // Unit counter and bus name
+    ATTR_FUNCTIONS,  // Function key bar
+    ATTR_TYPES,      // Unit type bar
+    ATTR_STATUS,     // Search and filter prompt
+    ATTR_ERROR,      // Errors and warnings
+    MAX_THEME_ATTRS
+};
+
+/* Attributes of the current color scheme, compiled by apply_color_scheme() */
+static attr_t theme[MAX_THEME_ATTRS];
+
+// The sort column behind each header
+static const enum sort_field header_sort_fields[BOLD_NONE] = {
+    SORT_BY_UNIT,
+    SORT_BY_STATE,
+    SORT_BY_ACTIVE,
+    SORT_BY_SUB,
+    SORT_BY_DESCRIPTION};
+
 int colorscheme = 0;
 
 int D_XLOAD = 84;
@@ -72,100 +174,392 @@ int D_XACTIVE = 94;
 int D_XSUB = 104;
 int D_XDESCRIPTION = 114;
 
-// Sort order for STATE values
-static const char *state_order[] = {
-    "enabled",
-    "enabled-runtime",
-    "loaded",
-    "generated",
-    "transient",
-    "static",
-    "not-found",
-    "disabled",
-    "masked",
-    NULL // End marker
-};
+/* Mark a header with its place in the sort order and its direction */
+static void display_sort_mark(int row, int x, BoldHeader header)
+{
+    for (int i = 0; i < view.order.count; i++)
+    {
+        if (view.order.keys[i].field != header_sort_fields[header])
+            continue;
 
-// Sort order for ACTIVE values
-static const char *active_order[] = {
-    "active",
-    "inactive",
-    NULL // End marker
-};
+        if (view.order.count > 1)
+            mvprintw(row, x++, "%d", i + 1);
+        mvaddch(row, x, view.order.keys[i].descending ? ACS_DARROW : ACS_UARROW);
+        return;
+    }
+}
 
-// Sort order for SUB values
-static const char *sub_order[] = {
-    "exited",
-    "running",
-    "mounted",
-    "active",
-    "dead",
-    "waiting",
-    "plugged",
-    "listening",
-    NULL // End marker
-};
+/* Order two units by the sort columns of the view. Ties, and all units
+ * while no column is chosen, are ordered by object path as they are
+ * listed, so the order is total and a unit has exactly one place in it. */
+static int display_compare(const Service *svc1, const Service *svc2)
+{
+    int result = sort_compare(svc1, svc2, &view.order);
 
-// Helper function: Returns the index of a string in an array
-static int get_index_in_array(const char *value, const char **array)
+    if (result)
+        return result;
+    return strcmp(svc1->object, svc2->object);
+}
+
+static bool display_view_accepts(Service *svc)
 {
-    if (!value)
-        return -1;
+    if (mode != ALL && mode != svc->type)
+        return false;
+    return !unit_filter || filter_matches(unit_filter, svc);
+}
+
+/* Unit field changes only matter to a view that is filtered or sorted */
+static unsigned long display_view_changes(void)
+{
+    return unit_filter || view.order.count ? filter_changes() : 0;
+}
 
-    for (int i = 0; array[i] != NULL; i++)
+/* Record the index of units in the view from start to end inclusive */
+static void display_view_number(int start, int end)
+{
+    for (int i = start; i <= end && i < view.count; i++)
+        view.units[i]->view_pos = i;
+}
+
+/* Rebuild the view if anything it was built from has changed. Units whose
+ * fields did not change keep their cached filter result. */
+static void display_view_update(Bus *bus)
+{
+    service_match *matches = NULL;
+    Service *svc = NULL;
+    uint32_t generation = unit_filter ? unit_filter->generation : 0;
+    unsigned long changes = display_view_changes();
+    int count = 0, needed;
+
+    // With lazy_unit_types, a type is listed once it is first shown
+    bus_fetch_type(bus, mode);
+
+    if (view.valid && view.bus == bus && view.revision == bus->revision &&
+        view.mode == mode && view.generation == generation && view.changes == changes)
+        return;
+
+    if (search_active && search.len > 0)
+        matches = service_search_results(&search, &count);
+
+    // The type counters are exact, so they bound the list size
+    needed = matches ? count : bus->total_types[ALL];
+    if (needed > view.size)
+    {
+        Service **units = realloc(view.units, needed * sizeof(Service *));
+
+        if (!units)
+            sm_err_set("Cannot allocate the unit list: %s", strerror(errno));
+        view.units = units;
+        view.size = needed;
+    }
+
+    view.count = 0;
+    if (matches)
     {
-        if (strcmp(value, array[i]) == 0)
+        for (int i = 0; i < count; i++)
         {
-            return i;
+            if (display_view_accepts(matches[i].svc))
+                view.units[view.count++] = matches[i].svc;
         }
     }
-    return 999; // Not found, sort to the end
+    else
+    {
+        TAILQ_FOREACH(svc, &bus->services, e)
+        {
+            if (view.count < view.size && display_view_accepts(svc))
+                view.units[view.count++] = svc;
+        }
+
+        // Search results keep their ranking, the plain list its sort columns.
+        // The list is in object path order and the sort is stable, which
+        // leaves ties in the order display_compare() expects.
+        if (sort_units(view.units, view.count, &view.order) < 0)
+            sm_err_set("Cannot sort the unit list: %s", strerror(errno));
+    }
+    display_view_number(0, view.count - 1);
+
+    view.valid = true;
+    view.moves++;
+    view.bus = bus;
+    view.revision = bus->revision;
+    view.mode = mode;
+    view.generation = generation;
+    view.changes = changes;
 }
 
-// Generic comparison function
-static int compare_services(const void *a, const void *b)
+/* Move a unit whose fields changed to its place in the view, or in or out
+ * of the view if the filter now decides differently. Returns false if the
+ * view cannot be patched and has to be rebuilt. */
+static bool display_view_reposition(Bus *bus, Service *svc)
 {
-    Service *svc1 = *(Service **)a;
-    Service *svc2 = *(Service **)b;
-    int result = 0;
+    int pos = svc->view_pos;
+    int lo = 0, hi = 0;
+    bool present = pos >= 0 && pos < view.count && view.units[pos] == svc;
+    bool accepted = false;
 
-    switch (current_bold_header)
+    // Units of the other bus are not in the view
+    if (bus != view.bus)
+        return true;
+
+    // Search results are ordered by score, which changes with the fields
+    if ((search_active && search.len > 0) || view.mode != mode)
+        return false;
+
+    accepted = svc->listed && display_view_accepts(svc);
+
+    // Still in order with its neighbours, nothing moves
+    if (present && accepted &&
+        (pos == 0 || display_compare(view.units[pos - 1], svc) < 0) &&
+        (pos == view.count - 1 || display_compare(svc, view.units[pos + 1]) < 0))
+        return true;
+
+    // Neither in the view nor going to be, nothing on screen changes
+    if (!present && !accepted)
+        return true;
+
+    view.moves++;
+    if (present)
     {
-    case BOLD_UNIT:
-        result = strcmp(svc1->unit, svc2->unit);
-        return unit_sort_direction == SORT_ASCENDING ? result : -result;
+        memmove(&view.units[pos], &view.units[pos + 1], (view.count - pos - 1) * sizeof(Service *));
+        view.count--;
+    }
 
-    case BOLD_STATE:
+    if (!accepted)
     {
-        int idx1 = get_index_in_array(svc1->unit_file_state, state_order);
-        int idx2 = get_index_in_array(svc2->unit_file_state, state_order);
-        result = idx1 - idx2;
-        return state_sort_direction == SORT_ASCENDING ? result : -result;
+        if (present)
+            display_view_number(pos, view.count - 1);
+        return true;
     }
 
-    case BOLD_ACTIVE:
+    if (view.count >= view.size)
+        return false;
+
+    // Binary search for the first unit ordered after this one
+    hi = view.count;
+    while (lo < hi)
     {
-        int idx1 = get_index_in_array(svc1->active, active_order);
-        int idx2 = get_index_in_array(svc2->active, active_order);
-        result = idx1 - idx2;
-        return active_sort_direction == SORT_ASCENDING ? result : -result;
+        int mid = lo + (hi - lo) / 2;
+
+        if (display_compare(view.units[mid], svc) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    case BOLD_SUB:
+    memmove(&view.units[lo + 1], &view.units[lo], (view.count - lo) * sizeof(Service *));
+    view.units[lo] = svc;
+    view.count++;
+
+    // Only the units between the old and the new place shifted
+    if (present)
+        display_view_number(MIN(pos, lo), MAX(pos, lo));
+    else
+        display_view_number(lo, view.count - 1);
+    return true;
+}
+
+/**
+ * Tells the display that fields of a unit changed through a signal.
+ *
+ * Instead of rebuilding the list, the unit alone is moved to its place in
+ * the sort order of the view, found by binary search.
+ *
+ * @param bus The bus the unit belongs to
+ * @param svc The unit whose fields changed
+ */
+void display_unit_changed(Bus *bus, Service *svc)
+{
+    bool current = view.valid && view.changes == display_view_changes();
+
+    filter_invalidate(svc);
+    snapshot_touch(bus, svc);
+    if (current && display_view_reposition(bus, svc))
+        view.changes = display_view_changes();
+}
+
+/* Return the nth unit of the list as it is displayed */
+static Service *display_nth(Bus *bus, int n)
+{
+    display_view_update(bus);
+    if (n < 0 || n >= view.count)
+        return NULL;
+    return view.units[n];
+}
+
+/* Return the number of units in the list as it is displayed */
+static int display_count(Bus *bus)
+{
+    display_view_update(bus);
+    return view.count;
+}
+
+/* Scroll the list so that the given unit becomes the selected one */
+static void display_select_unit(Bus *bus, Service *target, int max_visible_rows)
+{
+    int idx = 0;
+
+    if (mode != ALL && mode != target->type)
+        mode = target->type;
+
+    display_view_update(bus);
+    while (idx < view.count && view.units[idx] != target)
+        idx++;
+
+    // Hidden by the filter expression, stay at the top
+    if (idx == view.count)
+        idx = 0;
+
+    if (idx >= max_visible_rows)
     {
-        int idx1 = get_index_in_array(svc1->sub, sub_order);
-        int idx2 = get_index_in_array(svc2->sub, sub_order);
-        result = idx1 - idx2;
-        return sub_sort_direction == SORT_ASCENDING ? result : -result;
+        index_start = idx - max_visible_rows + 1;
+        position = max_visible_rows - 1;
     }
+    else
+    {
+        index_start = 0;
+        position = idx;
+    }
+}
 
-    case BOLD_DESCRIPTION:
-        result = strcmp(svc1->description, svc2->description);
-        return description_sort_direction == SORT_ASCENDING ? result : -result;
+/* Ask for a new filter expression, an empty one removes the filter */
+static void display_filter_edit(void)
+{
+    char expression[FILTER_MAX_LENGTH + 1] = {0};
+    char error[256] = {0};
+    filter_expr *f = NULL;
+
+    if (unit_filter)
+        snprintf(expression, sizeof(expression), "%s", unit_filter->expression);
+
+    if (!display_input_window("Filter", "Filter: ", expression, sizeof(expression)))
+        return;
+
+    if (expression[strspn(expression, " ")] != '\0')
+    {
+        f = filter_compile(expression, error, sizeof(error));
+        if (!f)
+        {
+            display_status_window(error, "Invalid filter");
+            return;
+        }
+    }
+
+    filter_free(unit_filter);
+    unit_filter = f;
+    position = 0;
+    index_start = 0;
+}
+
+/* Start narrowing the list of all units as the user types */
+static void display_search_begin(Bus *bus)
+{
+    if (search_active)
+        return;
+
+    search_saved_mode = mode;
+    search_saved_position = position;
+    search_saved_index_start = index_start;
+
+    service_search_start(bus, &search);
+    search_active = true;
+    view.valid = false;
+
+    mode = ALL;
+    position = 0;
+    index_start = 0;
+}
+
+/**
+ * Handles a key pressed while a search is running.
+ *
+ * Printable characters extend the query, Backspace shortens it, and each
+ * change narrows or widens the displayed list at once. Return jumps to the
+ * selected unit in the list it belongs to, ESC restores the list as it was
+ * before the search. Navigation keys and mouse clicks are left to the list.
+ *
+ * @param bus The bus being searched
+ * @param c The key pressed
+ * @param max_visible_rows The number of rows the list can show
+ * @return true if the key was consumed, false for navigation keys and clicks
+ */
+static bool display_search_key(Bus *bus, int c, int max_visible_rows)
+{
+    Service *svc = NULL;
+
+    switch (c)
+    {
+    case ERR:
+    case KEY_UP:
+    case KEY_DOWN:
+    case KEY_PPAGE:
+    case KEY_NPAGE:
+    case KEY_MOUSE:
+        return false;
+
+    case KEY_ESC:
+        service_search_end(&search);
+        search_active = false;
+        view.valid = false;
+        mode = search_saved_mode;
+        position = search_saved_position;
+        index_start = search_saved_index_start;
+        return true;
+
+    case KEY_RETURN:
+        svc = display_nth(bus, position + index_start);
+        service_search_end(&search);
+        search_active = false;
+        view.valid = false;
+        mode = search_saved_mode;
+        position = search_saved_position;
+        index_start = search_saved_index_start;
+        if (svc)
+            display_select_unit(bus, svc, max_visible_rows);
+        return true;
+
+    case KEY_BACKSPACE:
+    case 127:
+    case 8:
+        service_search_pop(&search);
+        break;
 
     default:
-        return 0; // No sorting if no header is highlighted
+        // Function keys and the like are ignored while typing
+        if (c < 32 || c > 126)
+            return true;
+        service_search_push(&search, c);
+        break;
     }
+
+    view.valid = false;
+    position = 0;
+    index_start = 0;
+    return true;
+}
+
+/* Show the query of a running search or the filter expression in the
+ * bottom border */
+static void display_search_prompt(Bus *bus)
+{
+    int maxy, maxx, count = 0;
+
+    if (!search_active && !unit_filter)
+        return;
+
+    getmaxyx(stdscr, maxy, maxx);
+    (void)maxx;
+
+    attron(theme[ATTR_STATUS]);
+    if (!search_active)
+        mvprintw(maxy - 1, 2, " Filter: %s (%d units, F: Edit) ", unit_filter->expression, display_count(bus));
+    else if (search.len > 0)
+    {
+        service_search_results(&search, &count);
+        mvprintw(maxy - 1, 2, " Search: %s_ (%d matches, Return: Jump, ESC: Cancel) ", search.query, count);
+    }
+    else
+        mvprintw(maxy - 1, 2, " Search: _ (Type to narrow the list, ESC: Cancel) ");
+    attroff(theme[ATTR_STATUS]);
 }
 
 /**
@@ -225,6 +619,37 @@ void set_color_scheme(int scheme)
     init_color_pairs();
 }
 
+/**
+ * Compiles the attributes drawing uses for a color scheme.
+ *
+ * Light schemes need other color pairs for text and the selected row, the
+ * selection colors of a scheme override the defaults.
+ *
+ * @param scheme The color scheme being applied.
+ */
+static void display_theme_compile(const ColorScheme *scheme)
+{
+    bool solarized_light = !strcmp(scheme->name, "Solarized Light");
+    bool monochrome = !strcmp(scheme->name, "Monochrome");
+
+    theme[ATTR_TEXT] = COLOR_PAIR(solarized_light ? MAGENTA_BLACK : BLACK_WHITE);
+    theme[ATTR_SELECTION] = COLOR_PAIR(monochrome ? WHITE_RED : WHITE_BLUE) | A_BOLD;
+    theme[ATTR_MARKED] = COLOR_PAIR(YELLOW_BLACK) | A_BOLD;
+    theme[ATTR_CACHED] = A_DIM;
+    theme[ATTR_SORTED] = COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD;
+    theme[ATTR_COUNT] = COLOR_PAIR(GREEN_BLACK);
+    theme[ATTR_FUNCTIONS] = COLOR_PAIR(WHITE_RED);
+    theme[ATTR_TYPES] = COLOR_PAIR(BLACK_GREEN);
+    theme[ATTR_STATUS] = COLOR_PAIR(BLACK_GREEN) | A_BOLD;
+    theme[ATTR_ERROR] = COLOR_PAIR(RED_BLACK);
+
+    if (scheme->selection[0] >= 0 && scheme->selection[1] >= 0)
+    {
+        init_pair(SELECTION, scheme->selection[0], scheme->selection[1]);
+        theme[ATTR_SELECTION] = COLOR_PAIR(SELECTION) | A_BOLD;
+    }
+}
+
 // Convert RGB value to ncurses color value
 static short rgb_to_ncurses(short value)
 {
@@ -280,83 +705,184 @@ static void apply_color_scheme(const ColorScheme *scheme)
                rgb_to_ncurses(scheme->white[0]),
                rgb_to_ncurses(scheme->white[1]),
                rgb_to_ncurses(scheme->white[2]));
+
+    display_theme_compile(scheme);
 }
 
+/* Buffer rows are composed in, reused for every row */
+static char *row_buffer = NULL;
+static size_t row_buffer_size = 0;
+
+/* Bytes a column may take per cell, UTF-8 needs up to 4 for a character */
+#define D_CELL_BYTES 4
+
 /**
- * Handles the display of a service row with all its details.
+ * Copies a string into a column of exactly the given width.
  *
- * @param svc The service to display
- * @param row The row number (relative position)
- * @param spc The spacing/offset from the top
+ * Shorter strings are padded with spaces, longer ones are cut, after the
+ * last character fitting before "..." if ellipsis is set. Widths are counted
+ * in screen cells of the UTF-8 characters, a wide character is never split
+ * and undecodable bytes show as '?'.
+ *
+ * @param out Receives the column, at most width * D_CELL_BYTES bytes.
+ * @param str The string to copy.
+ * @param width The width of the column in cells.
+ * @param ellipsis Whether a cut string ends with "...".
+ * @return The number of bytes written to out.
  */
-static void display_service_row(Service *svc, int row, int spc)
+static size_t display_fit(char *out, const char *str, int width, bool ellipsis)
 {
-    int i;
-    char short_unit[D_XLOAD - 4];
-    char short_unit_file_state[10];
-    char *short_description;
-    size_t maxx_description = getmaxx(stdscr) - D_XDESCRIPTION - 1;
+    size_t max = (size_t)width * D_CELL_BYTES;
+    size_t len = 0, mark = 0;
+    int cols = 0, mark_cols = 0;
+    int room = ellipsis && width > 3 ? width - 3 : width;
+    mbstate_t state;
+
+    memset(&state, 0, sizeof(state));
+    while (*str)
+    {
+        wchar_t wc;
+        size_t used = mbrtowc(&wc, str, MB_CUR_MAX, &state);
+        const char *src = str;
+        size_t n = used;
+        int w = 1;
+
+        // Undecodable bytes and control characters show as '?'
+        if (used == (size_t)-1 || used == (size_t)-2)
+        {
+            memset(&state, 0, sizeof(state));
+            used = 1;
+            src = "?";
+            n = 1;
+        }
+        else if ((w = wcwidth(wc)) < 0)
+        {
+            src = "?";
+            n = 1;
+            w = 1;
+        }
 
-    // Clear the unit name column
-    for (i = 1; i < D_XLOAD - 1; i++)
-        mvaddch(row + spc, i, ' ');
+        if (cols + w > width || len + n > max)
+        {
+            // Cut, back to the last place "..." still fits after
+            if (ellipsis && width > 3)
+            {
+                memcpy(out + mark, "...", 3);
+                len = mark + 3;
+                cols = mark_cols + 3;
+            }
+            break;
+        }
 
-    // If the unit name is too long, truncate it and add ...
-    if (strlen(svc->unit) >= (size_t)(D_XLOAD - 4))
-    {
-        strncpy(short_unit, svc->unit, D_XLOAD - 4);
-        mvaddstr(row + spc, 1, short_unit);
-        mvaddstr(row + spc, D_XLOAD - 4, "...");
+        memcpy(out + len, src, n);
+        str += used;
+        len += n;
+        cols += w;
+
+        if (cols <= room)
+        {
+            mark = len;
+            mark_cols = cols;
+        }
     }
-    else
-        mvaddstr(row + spc, 1, svc->unit);
 
-    // Clear the state column
-    for (i = D_XLOAD; i < D_XACTIVE - 1; i++)
-        mvaddch(row + spc, i, ' ');
+    memset(out + len, ' ', width - cols);
+    return len + width - cols;
+}
 
-    // If the state is too long, truncate it (enabled-runtime will be enabled-r)
-    if (!svc->unit_file_state || strlen(svc->unit_file_state) == 0)
-        mvprintw(row + spc, D_XLOAD, "%s", svc->load);
-    else if (strlen(svc->unit_file_state) > 9)
-    {
-        strncpy(short_unit_file_state, svc->unit_file_state, 9);
-        short_unit_file_state[9] = '\0';
-        mvaddstr(row + spc, D_XLOAD, short_unit_file_state);
-    }
-    else
-        mvprintw(row + spc, D_XLOAD, "%s", svc->unit_file_state ? svc->unit_file_state : svc->load);
+/**
+ * Composes the text of a unit row, one NUL terminated string per column.
+ *
+ * The row is kept with the unit and composed again only once a field of the
+ * unit changed (see filter_invalidate()) or the columns moved.
+ *
+ * @param svc The unit to compose the row of.
+ * @return The row, or NULL if out of memory.
+ */
+static const char *display_compose_row(Service *svc)
+{
+    const char *state = svc->unit_file_state && *svc->unit_file_state ? svc->unit_file_state : svc->load;
+    int description_width = layout.cols - D_XDESCRIPTION - 1;
+    size_t size, len = 0;
+    char *row;
+
+    if (svc->row && svc->row_layout == layout.id)
+        return svc->row;
 
-    // Clear the active column
-    for (i = D_XACTIVE; i < D_XSUB - 1; i++)
-        mvaddch(row + spc, i, ' ');
+    if (description_width < 0)
+        description_width = 0;
 
-    mvprintw(row + spc, D_XACTIVE, "%s", svc->active);
+    size = (size_t)(D_XDESCRIPTION - 5 + description_width) * D_CELL_BYTES + 5;
+    if (size > row_buffer_size)
+    {
+        char *buffer = realloc(row_buffer, size);
 
-    // Clear the sub column
-    for (i = D_XSUB; i < D_XDESCRIPTION - 1; i++)
-        mvaddch(row + spc, i, ' ');
+        if (!buffer)
+            return NULL;
+        row_buffer = buffer;
+        row_buffer_size = size;
+    }
 
-    mvprintw(row + spc, D_XSUB, "%s", svc->sub);
+    // Separators between the columns are not part of the row
+    len += display_fit(row_buffer + len, svc->unit, D_XLOAD - 2, true);
+    row_buffer[len++] = '\0';
+    len += display_fit(row_buffer + len, state ? state : "", D_XACTIVE - D_XLOAD - 1, false);
+    row_buffer[len++] = '\0';
+    len += display_fit(row_buffer + len, svc->active ? svc->active : "", D_XSUB - D_XACTIVE - 1, false);
+    row_buffer[len++] = '\0';
+    len += display_fit(row_buffer + len, svc->sub ? svc->sub : "", D_XDESCRIPTION - D_XSUB - 1, false);
+    row_buffer[len++] = '\0';
+    len += display_fit(row_buffer + len, svc->description ? svc->description : "", description_width, true);
+    row_buffer[len++] = '\0';
+
+    row = realloc(svc->row, len);
+    if (!row)
+        return NULL;
+    memcpy(row, row_buffer, len);
+
+    svc->row = row;
+    svc->row_layout = layout.id;
+    return row;
+}
+
+/**
+ * Handles the display of a service row with all its details.
+ *
+ * @param svc The service to display
+ * @param row The row number (relative position)
+ * @param spc The spacing/offset from the top
+ */
+static void display_service_row(Service *svc, int row, int spc)
+{
+    const int columns[] = {1, D_XLOAD, D_XACTIVE, D_XSUB, D_XDESCRIPTION};
+    const char *text = display_compose_row(svc);
 
-    // Clear the description column
-    for (i = D_XDESCRIPTION; i < getmaxx(stdscr) - 1; i++)
-        mvaddch(row + spc, i, ' ');
+    if (!text)
+        sm_err_set("Cannot compose the row of %s: %s", svc->unit, strerror(errno));
 
-    // If the description is too long, truncate it and add ...
-    if (strlen(svc->description) >= maxx_description)
+    // One string per column, the separators in between stay as drawn
+    for (int i = 0; i < 5; i++)
     {
-        short_description = alloca(maxx_description + 1);
-        memset(short_description, 0, maxx_description + 1);
-        strncpy(short_description, svc->description, maxx_description - 3);
-        mvaddstr(row + spc, D_XDESCRIPTION, short_description);
-        mvaddstr(row + spc, D_XDESCRIPTION + maxx_description - 3, "...");
+        mvaddstr(row + spc, columns[i], text);
+        text += strlen(text) + 1;
     }
-    else
-        mvaddstr(row + spc, D_XDESCRIPTION, svc->description);
+}
 
-    // Save the y-position of the service
-    svc->ypos = row + spc;
+/* Draw a unit in the given list row, highlighted if it is the selected one */
+static void display_service_line(Service *svc, int row, int spc)
+{
+    attr_t attr = 0;
+
+    if (row == position)
+        attr = theme[ATTR_SELECTION];
+    else if (svc->marked)
+        attr = theme[ATTR_MARKED];
+    else if (svc->cached)
+        attr = theme[ATTR_CACHED];
+
+    attron(attr);
+    display_service_row(svc, row, spc);
+    attroff(attr);
 }
 
 /**
@@ -372,74 +898,42 @@ static void display_service_row(Service *svc, int row, int spc)
 static void display_services(Bus *bus)
 {
     int max_rows, maxy;
-    int row = 0;
-    int idx = index_start;
-    Service *svc;
-    int headerrow = 3;
-    struct winsize size;
-    int visible_services = 0;
-    int total_services = 0;
+    int row;
     int dummy_maxx;
 
     getmaxyx(stdscr, maxy, dummy_maxx);
     (void)dummy_maxx;
 
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
-    if (size.ws_col < (strlen(D_FUNCTIONS) + strlen(D_SERVICE_TYPES) + 2))
-    {
-        headerrow = 4;
-    }
-
-    int spc = headerrow + 2;
+    int spc = layout.header_row + 2;
     max_rows = maxy - spc - 1;
 
-    // Count the total number of services of the current type
-    for (int i = 0;; i++)
-    {
-        svc = service_nth(bus, i);
-        if (!svc)
-            break;
-        if (mode == ALL || mode == svc->type)
-            total_services++;
-    }
+    // Only the units in the viewport are visited, however long the list
+    display_view_update(bus);
+    for (row = 0; row < max_rows && index_start + row < view.count; row++)
+        display_service_line(view.units[index_start + row], row, spc);
 
-    services_invalidate_ypos(bus);
-
-    while (true)
-    {
-        svc = service_nth(bus, idx);
-        if (!svc)
-            break;
-
-        if (row >= max_rows)
-            break;
-
-        if (mode != ALL && mode != svc->type)
-        {
-            idx++;
-            continue;
-        }
+    screen.rows = row;
+}
 
-        if (row == position)
-        {
-            // Monochrome theme needs a different color pair
-            !strcmp(color_schemes[colorscheme].name, "Monochrome") ? attron(COLOR_PAIR(WHITE_RED)) : attron(COLOR_PAIR(WHITE_BLUE));
-            attron(A_BOLD);
-        }
+/* Draw the number of units of the shown type into the header row. The row
+ * is not cleared, so a number shorter than the last one is padded. */
+static void display_type_count(Bus *bus, int headerrow)
+{
+    static int last_len = 0;
+    char count[48];
+    int x = D_XLOAD / 2 - 10;
+    int len;
 
-        display_service_row(svc, row, spc);
+    len = snprintf(count, sizeof(count), "%s: %d", service_string_type(mode), bus->total_types[mode]);
+    count[0] = toupper(count[0]);
 
-        if (row == position)
-        {
-            // Monochrome theme needs a different color pair
-            !strcmp(color_schemes[colorscheme].name, "Monochrome") ? attroff(COLOR_PAIR(WHITE_RED)) : attroff(COLOR_PAIR(WHITE_BLUE));
-            attroff(A_BOLD);
-        }
+    attron(theme[ATTR_COUNT] | A_UNDERLINE);
+    mvaddstr(headerrow, x, count);
+    attroff(theme[ATTR_COUNT] | A_UNDERLINE);
 
-        row++;
-        idx++;
-        visible_services++;
-    }
+    if (len < last_len)
+        mvprintw(headerrow, x + len, "%*s", last_len - len, "");
+    last_len = len;
 }
 
 /**
@@ -449,24 +943,13 @@ static void display_services(Bus *bus)
  */
 static void display_text_and_lines(Bus *bus)
 {
-    int x = D_XLOAD / 2 - 10;
     int maxx, maxy;
-    char tmptype[16] = {0};
-    int headerrow = 3;
+    int headerrow = layout.header_row;
     char navigation[256]; // Buffer for the complete navigation text
 
-    struct winsize size;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
-
-    if (size.ws_col < (strlen(D_FUNCTIONS) + strlen(D_SERVICE_TYPES) + 2))
-    {
-        headerrow++;
-    }
-
     getmaxyx(stdscr, maxy, maxx);
 
-    // Solarized light theme needs a different color pair
-    !strcmp(color_schemes[colorscheme].name, "Solarized Light") ? attron(COLOR_PAIR(MAGENTA_BLACK)) : attron(COLOR_PAIR(BLACK_WHITE));
+    attron(theme[ATTR_TEXT]);
 
     border(0, 0, 0, 0, 0, 0, 0, 0);
 
@@ -475,107 +958,100 @@ static void display_text_and_lines(Bus *bus)
 
     attron(A_BOLD);
     mvaddstr(1, 1, D_HEADLINE);
-    mvaddstr(1, strlen(D_HEADLINE) + 1 + ((size.ws_col - strlen(D_HEADLINE) - strlen(D_QUIT) - strlen(navigation) - 2) / 2), navigation);
-    mvaddstr(1, size.ws_col - strlen(D_QUIT) - 1, D_QUIT);
+    mvaddstr(1, strlen(D_HEADLINE) + 1 + ((layout.cols - strlen(D_HEADLINE) - strlen(D_QUIT) - strlen(navigation) - 2) / 2), navigation);
+    mvaddstr(1, layout.cols - strlen(D_QUIT) - 1, D_QUIT);
 
-    attron(COLOR_PAIR(WHITE_RED));
+    attron(theme[ATTR_FUNCTIONS]);
     mvaddstr(2, 1, D_FUNCTIONS);
-    attroff(COLOR_PAIR(WHITE_RED));
+    attroff(theme[ATTR_FUNCTIONS]);
 
-    attron(COLOR_PAIR(BLACK_GREEN));
-    if (size.ws_col < (strlen(D_FUNCTIONS) + strlen(D_SERVICE_TYPES) + 2))
+    attron(theme[ATTR_TYPES]);
+    if (headerrow == 4)
     {
         mvaddstr(3, 1, D_SERVICE_TYPES);
     }
     else
     {
-        mvaddstr(2, size.ws_col - strlen(D_SERVICE_TYPES) - 1, D_SERVICE_TYPES);
+        mvaddstr(2, layout.cols - strlen(D_SERVICE_TYPES) - 1, D_SERVICE_TYPES);
     }
-    attroff(COLOR_PAIR(BLACK_GREEN));
+    attroff(theme[ATTR_TYPES]);
     attroff(A_BOLD);
 
-    // Solarized light theme needs a different color pair
-    !strcmp(color_schemes[colorscheme].name, "Solarized Light") ? attron(COLOR_PAIR(MAGENTA_BLACK)) : attron(COLOR_PAIR(BLACK_WHITE));
+    attron(theme[ATTR_TEXT]);
     mvprintw(headerrow, D_XLOAD - 10, "Pos.:%3d", position + index_start);
 
     // UNIT Header
     if (current_bold_header == BOLD_UNIT)
     {
-        attron(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attron(theme[ATTR_SORTED]);
         mvprintw(headerrow, 1, "UNIT:");
-        attroff(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attroff(theme[ATTR_SORTED]);
     }
     else
     {
         mvprintw(headerrow, 1, "UNIT:");
     }
 
-    attron(COLOR_PAIR(GREEN_BLACK));
+    attron(theme[ATTR_COUNT]);
     mvprintw(headerrow, 7, "(%s)", type ? "USER" : "SYSTEM");
-    attroff(COLOR_PAIR(GREEN_BLACK));
+    attroff(theme[ATTR_COUNT]);
+    display_sort_mark(headerrow, type ? 14 : 16, BOLD_UNIT);
 
-    // Solarized light theme needs a different color pair
-    !strcmp(color_schemes[colorscheme].name, "Solarized Light") ? attron(COLOR_PAIR(MAGENTA_BLACK)) : attron(COLOR_PAIR(BLACK_WHITE));
+    attron(theme[ATTR_TEXT]);
 
     // STATE Header
     if (current_bold_header == BOLD_STATE)
     {
-        attron(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attron(theme[ATTR_SORTED]);
         mvprintw(headerrow, D_XLOAD, "STATE:");
-        attroff(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attroff(theme[ATTR_SORTED]);
     }
     else
     {
         mvprintw(headerrow, D_XLOAD, "STATE:");
     }
+    display_sort_mark(headerrow, D_XLOAD + 6, BOLD_STATE);
 
     // ACTIVE Header
     if (current_bold_header == BOLD_ACTIVE)
     {
-        attron(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attron(theme[ATTR_SORTED]);
         mvprintw(headerrow, D_XACTIVE, "ACTIVE:");
-        attroff(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attroff(theme[ATTR_SORTED]);
     }
     else
     {
         mvprintw(headerrow, D_XACTIVE, "ACTIVE:");
     }
+    display_sort_mark(headerrow, D_XACTIVE + 7, BOLD_ACTIVE);
 
     // SUB Header
     if (current_bold_header == BOLD_SUB)
     {
-        attron(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attron(theme[ATTR_SORTED]);
         mvprintw(headerrow, D_XSUB, "SUB:");
-        attroff(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attroff(theme[ATTR_SORTED]);
     }
     else
     {
         mvprintw(headerrow, D_XSUB, "SUB:");
     }
+    display_sort_mark(headerrow, D_XSUB + 4, BOLD_SUB);
 
     // DESCRIPTION Header
     if (current_bold_header == BOLD_DESCRIPTION)
     {
-        attron(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attron(theme[ATTR_SORTED]);
         mvprintw(headerrow, D_XDESCRIPTION, "DESCRIPTION:");
-        attroff(COLOR_PAIR(WHITE_BLUE) | A_REVERSE | A_BOLD);
+        attroff(theme[ATTR_SORTED]);
     }
     else
     {
         mvprintw(headerrow, D_XDESCRIPTION, "DESCRIPTION:");
     }
+    display_sort_mark(headerrow, D_XDESCRIPTION + 12, BOLD_DESCRIPTION);
 
-    attron(COLOR_PAIR(GREEN_BLACK));
-    attron(A_UNDERLINE);
-
-    // Sets the type count
-    strncpy(tmptype, service_string_type(mode), 16);
-    tmptype[sizeof(tmptype) - 1] = '\0';
-    tmptype[0] = toupper(tmptype[0]);
-    mvprintw(headerrow, x, "%s: %d", tmptype, bus->total_types[mode]);
-
-    attroff(COLOR_PAIR(GREEN_BLACK));
-    attroff(A_UNDERLINE);
+    display_type_count(bus, headerrow);
     attroff(A_BOLD);
     mvhline(headerrow + 1, 1, ACS_HLINE, maxx - 2);
     mvvline(headerrow, D_XLOAD - 1, ACS_VLINE, maxy - 3);
@@ -584,240 +1060,133 @@ static void display_text_and_lines(Bus *bus)
     mvvline(headerrow, D_XDESCRIPTION - 1, ACS_VLINE, maxy - 3);
 }
 
+/* Rows the list scrolls per wheel step */
+#define D_WHEEL_ROWS 3
+
+/* The header of the column at screen column x */
+static BoldHeader display_header_at(int x)
+{
+    if (x < D_XLOAD - 1)
+        return BOLD_UNIT;
+    if (x < D_XACTIVE - 1)
+        return BOLD_STATE;
+    if (x < D_XSUB - 1)
+        return BOLD_ACTIVE;
+    if (x < D_XDESCRIPTION - 1)
+        return BOLD_SUB;
+    return BOLD_DESCRIPTION;
+}
+
+/**
+ * Handles a mouse event.
+ *
+ * A click on a unit selects it, a click on a column header sorts by that
+ * column like Return on a highlighted header, and the wheel scrolls the
+ * list.
+ *
+ * @param bus The bus being displayed.
+ * @param max_services The number of units in the list.
+ * @param max_visible_rows The number of rows of the list on screen.
+ */
+static void display_mouse(Bus *bus, int max_services, int max_visible_rows)
+{
+    int spc = layout.header_row + 2;
+    MEVENT ev;
+
+    if (getmouse(&ev) != OK)
+        return;
+
+    if (ev.bstate & BUTTON4_PRESSED)
+    {
+        index_start = MAX(index_start - D_WHEEL_ROWS, 0);
+    }
+    else if (ev.bstate & BUTTON5_PRESSED)
+    {
+        if (index_start + max_visible_rows < max_services)
+            index_start = MIN(index_start + D_WHEEL_ROWS, max_services - max_visible_rows);
+    }
+    else if (ev.bstate & BUTTON1_PRESSED)
+    {
+        if (ev.y == layout.header_row && ev.x > 0)
+        {
+            current_bold_header = display_header_at(ev.x);
+            sort_services_by_header(bus);
+        }
+        else if (ev.y >= spc && ev.y < spc + max_visible_rows && index_start + ev.y - spc < max_services)
+            position = ev.y - spc;
+    }
+}
+
 /**
- * Handles user input and performs various operations on systemd services.
+ * Handles a key and performs various operations on systemd services.
  * This function is responsible for:
  * - Handling user input from the keyboard, including navigation, service operations, and mode changes
- * - Updating the display based on the current state and user actions
  * - Calling appropriate functions to perform service operations (start, stop, restart, etc.)
  * - Reloading the service list when necessary
  *
- * @param s The event source that triggered the callback.
- * @param fd The file descriptor associated with the event source.
- * @param revents The events that occurred on the file descriptor.
- * @param data Arbitrary user data passed to the callback.
- * @return 0 to indicate the event was handled successfully.
+ * The screen is not redrawn, display_key_pressed() does that once for all
+ * keys pending.
+ *
+ * @param s The event source of the keyboard.
+ * @param bus The bus being displayed.
+ * @param c The key.
+ * @return The bus displayed after the key.
  */
-int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data)
+static Bus *display_key(sd_event_source *s, Bus *bus, int c)
 {
-    (void)fd;
-    int c;
     char *status = NULL;
     int max_services = 0;
     int maxy;
     int maxx;
 
     getmaxyx(stdscr, maxy, maxx);
+    (void)maxx;
 
-    int headerrow = 3;
-    struct winsize size;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
-    if (size.ws_col < (strlen(D_FUNCTIONS) + strlen(D_SERVICE_TYPES) + 2))
-    {
-        headerrow = 4;
-    }
-    int spc = headerrow + 2;               // +2 for the separator line and a space
+    int spc = layout.header_row + 2;       // +2 for the separator line and a space
     int max_visible_rows = maxy - spc - 1; // Exact calculation of visible rows
     int page_scroll = max_visible_rows;    // For Page Up/Down
     bool update_state = false;
     Service *svc = NULL;
-    Bus *bus = (Bus *)data;
-
-    if ((revents & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) > 0)
-        return 0;
 
-    c = getch();
+    // While searching, typed characters go to the query
+    if (search_active && display_search_key(bus, c, max_visible_rows))
+        c = ERR;
 
-    // Count the total number of services of the current type
-    for (int i = 0;; i++)
-    {
-        svc = service_nth(bus, i);
-        if (!svc)
-            break;
-        if (mode == ALL || mode == svc->type)
-            max_services++;
-    }
-
-    svc = service_nth(bus, position + index_start);
+    max_services = display_count(bus);
+    svc = display_nth(bus, position + index_start);
     set_escdelay(25);
 
     switch (c)
     {
     case 'f': // Search function
-    {
-        Service *found_service = NULL;
-        int max_input_length = 50;   // Internal buffer (can be longer than the window)
-        char search_query[51] = {0}; // Space for 50 characters + null termination
-        int win_height = 3, win_width = 80;
-        int starty = (maxy - win_height) / 2;
-        int startx = (maxx - win_width) / 2;
-        int cursor = 0; // Current position in search_query
-        int ch;
-        static bool search_in_progress = false;
-
-        if (search_in_progress)
-            break;
-        search_in_progress = true;
-
-        WINDOW *input_win = newwin(win_height, win_width, starty, startx);
-        box(input_win, 0, 0);
-        // Information line in window, show maximum length:
-        mvwprintw(input_win, 1, 1, "Search unit: ");
-        wrefresh(input_win);
-
-        echo(); // Show characters directly (optional, since we render ourselves)
-        curs_set(1);
-        // Switch the key input mode to non-blocking input field
-        keypad(input_win, TRUE);
-
-        // We only show the part of the input that fits in the window.
-        // Assume the visible area starts after displaying the static characters.
-        int offset = 1 + strlen("Search unit: ");
-        // How many characters fit in the visible area?
-        int visible_length = win_width - offset - 2; // 2 for border
-
-        // Process character-by-character input
-        while ((ch = wgetch(input_win)) != KEY_RETURN)
-        {
-            if ((ch == KEY_BACKSPACE || ch == 127) && cursor > 0)
-            {
-                cursor--;
-                search_query[cursor] = '\0';
-            }
-            else if (cursor < max_input_length && ch >= 32 && ch <= 126)
-            {
-                search_query[cursor++] = ch;
-                search_query[cursor] = '\0';
-            }
-            // Rendering: We calculate the start index so that if the input is longer than visible_length,
-            // only the last visible_length characters are displayed.
-            int start_index = 0;
-            if (cursor > visible_length)
-                start_index = cursor - visible_length;
-
-            // Clear the input area
-            for (int i = offset; i < win_width - 1; i++)
-            {
-                mvwaddch(input_win, 1, i, ' ');
-            }
-            // Display the visible part of the input
-            mvwprintw(input_win, 1, offset, "%s", &search_query[start_index]);
-            wmove(input_win, 1, offset + ((cursor > visible_length) ? visible_length : cursor));
-            wrefresh(input_win);
-        }
-        noecho();
-        curs_set(0);
-
-        // Clean up input window
-        delwin(input_win);
-        refresh();
-        flushinp();
-
-        // Clear any remaining input
-        while (getch() != ERR)
-            ;
-
-        // Exit search if query is empty
-        if (strlen(search_query) == 0)
-        {
-            search_in_progress = false;
-            break;
-        }
-
-        // Store current mode and switch to ALL to search across all services
-        enum service_type current_mode = mode;
-        mode = ALL;
-
-        // Search for service matching query
-        for (int i = 0;; i++)
-        {
-            Service *svc_iter = service_nth(bus, i);
-            if (!svc_iter)
-                break;
-
-            if (strcasestr(svc_iter->unit, search_query) != NULL)
-            {
-                found_service = svc_iter;
-                break;
-            }
-        }
-
-        if (found_service)
-        {
-            // Switch to found service's type
-            mode = found_service->type;
-            int filtered_pos = 0;
+        display_search_begin(bus);
+        break;
 
-            // Calculate position of found service in filtered list
-            for (int i = 0;; i++)
-            {
-                Service *svc = service_nth(bus, i);
-                if (!svc)
-                    break;
-
-                if (svc->type == mode)
-                {
-                    if (svc == found_service)
-                    {
-                        // Adjust scroll position to show found service
-                        if (filtered_pos >= max_visible_rows)
-                        {
-                            index_start = filtered_pos - max_visible_rows + 1;
-                            position = max_visible_rows - 1;
-                        }
-                        else
-                        {
-                            index_start = 0;
-                            position = filtered_pos;
-                        }
-                        break;
-                    }
-                    filtered_pos++;
-                }
-            }
+    case KEY_MOUSE:
+        display_mouse(bus, max_services, max_visible_rows);
+        break;
 
-            // Redraw display with found service
-            clear();
-            display_services(bus);
-            display_text_and_lines(bus);
-        }
-        else
-        {
-            // Restore previous mode if no service found
-            mode = current_mode;
-            display_status_window("No matching service found.", "Search");
-            clear();
-            display_services(bus);
-            display_text_and_lines(bus);
-        }
-        refresh();
+    case 'F':
+        display_filter_edit();
+        break;
 
-        // Reset search state and update start time
-        search_in_progress = false;
-        start_time = service_now();
-        return 0;
-    }
     case KEY_ESC:
         // If a header is highlighted, remove highlighting without sorting
         if (current_bold_header != BOLD_NONE)
         {
             current_bold_header = BOLD_NONE;
             header_highlighting_initialized = false;
-            clear();
-            display_redraw(bus);
-            refresh();
             break;
         }
 
-        nodelay(stdscr, TRUE); // Non-blocking mode
-        int esc_timeout = 50;  // 50ms Timeout for Escape sequences
-        wtimeout(stdscr, esc_timeout);
+        int esc_timeout = 50; // 50ms Timeout for Escape sequences
+        wtimeout(input, esc_timeout);
         // Buffer to store escape sequence characters
         char seq[10] = {0};
         int i = 0, c;
 
         // Read escape sequence characters until ERR or '~' is encountered
-        while ((c = getch()) != ERR && i < 9)
+        while ((c = wgetch(input)) != ERR && i < 9)
         {
             seq[i++] = c;
             if (c == '~')
@@ -848,11 +1217,13 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
             // Exit if ESC was pressed and enough time has passed since start
             if ((service_now() - start_time) < D_ESCOFF_MS)
                 break;
+            ingest_stop();
+            bus_save_cache();
             reset_terminal_title();
             endwin();
             exit(EXIT_SUCCESS);
         }
-        nodelay(stdscr, FALSE); // back to normal mode
+        nodelay(input, TRUE); // back to not waiting
         break;
     case KEY_F(1):
         d_op(bus, svc, START, "Start");
@@ -923,7 +1294,6 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
             index_start -= page_scroll;
             if (index_start < 0)
                 index_start = 0;
-            erase();
         }
         position = 0;
         break;
@@ -937,7 +1307,6 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
                 index_start = max_services - max_visible_rows;
             if (index_start < 0)
                 index_start = 0;
-            erase();
         }
         position = 0;
         break;
@@ -950,9 +1319,6 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
             if (current_bold_header > BOLD_UNIT)
             {
                 current_bold_header--;
-                clear();
-                display_redraw(bus);
-                refresh();
             }
             break;
         }
@@ -970,9 +1336,6 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
             if (current_bold_header < BOLD_DESCRIPTION)
             {
                 current_bold_header++;
-                clear();
-                display_redraw(bus);
-                refresh();
             }
             break;
         }
@@ -983,6 +1346,13 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
         break;
 
     case KEY_SPACE:
+        // With a header highlighted, add its column to the sort order
+        if (current_bold_header != BOLD_NONE)
+        {
+            display_sort_add_header();
+            break;
+        }
+
         if (bus_system_only())
         {
             display_status_window("Only system bus is available as root.", "sudo mode !");
@@ -992,7 +1362,6 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
         type ^= 0x1;
         bus = bus_currently_displayed();
         sd_event_source_set_userdata(s, bus);
-        erase();
         break;
 
     case KEY_RETURN:
@@ -1000,14 +1369,11 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
         if (current_bold_header != BOLD_NONE)
         {
             sort_services_by_header(bus);
-            clear();
-            display_redraw(bus);
-            refresh();
             break;
         }
 
         // Otherwise use original functionality (show status)
-        svc = service_nth(bus, position + index_start);
+        svc = display_nth(bus, position + index_start);
         if (!svc)
             break;
         status = service_status_info(bus, svc);
@@ -1068,6 +1434,37 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
         D_MODE(SNAPSHOT);
         break;
 
+    case 'J':
+        display_top_talkers(bus);
+        break;
+
+    case 'S':
+        status = service_statistics(bus);
+        if (status)
+            display_pager_window(status, "Statistics");
+        free(status);
+        status = NULL;
+        break;
+
+    case 'I':
+        if (svc)
+            display_invocations(bus, svc);
+        break;
+
+    case 'x':
+        if (svc)
+            svc->marked = !svc->marked;
+        break;
+
+    case 'X':
+        services_unmark(bus);
+        break;
+
+    case 'L':
+        if (svc)
+            display_merged_logs(bus, svc);
+        break;
+
     case '\t': // Tab key
         if (!header_highlighting_initialized)
         {
@@ -1082,12 +1479,11 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
         {
             current_bold_header++;
         }
-        clear();
-        display_redraw(bus);
-        refresh();
         break;
 
     case 'q':
+        ingest_stop();
+        bus_save_cache();
         endwin();
         exit(EXIT_SUCCESS);
         break;
@@ -1098,7 +1494,6 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
             colorscheme++;
             apply_color_scheme(&color_schemes[colorscheme]);
             set_color_scheme(colorscheme);
-            erase();
         }
         break;
 
@@ -1108,7 +1503,6 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
             colorscheme--;
             apply_color_scheme(&color_schemes[colorscheme]);
             set_color_scheme(colorscheme);
-            erase();
         }
         break;
 
@@ -1150,7 +1544,40 @@ int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data
         }
     }
 
-    // Full redraw of the screen
+    return bus;
+}
+
+/**
+ * Handles user input from the keyboard.
+ *
+ * All keys pending are handled before the screen is redrawn once, so a
+ * held key or pasted text costs one frame per wakeup instead of one per
+ * character.
+ *
+ * @param s The event source that triggered the callback.
+ * @param fd The file descriptor associated with the event source.
+ * @param revents The events that occurred on the file descriptor.
+ * @param data The bus being displayed.
+ * @return 0 to indicate the event was handled successfully.
+ */
+int display_key_pressed(sd_event_source *s, int fd, uint32_t revents, void *data)
+{
+    (void)fd;
+    Bus *bus = (Bus *)data;
+    int c;
+
+    if ((revents & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) > 0)
+        return 0;
+
+    // Keys may leave input blocking, the pending ones are read without waiting
+    nodelay(input, TRUE);
+    while ((c = wgetch(input)) != ERR)
+    {
+        bus = display_key(s, bus, c);
+        nodelay(input, TRUE);
+    }
+
+    // Full redraw of the screen, once for all the keys read
     erase();
     display_redraw(bus);
     refresh();
@@ -1197,9 +1624,6 @@ enum service_type display_mode(void)
  */
 void display_redraw(Bus *bus)
 {
-    struct winsize size;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
-
     // Create the headline text with root marking
     char headline[100];
     snprintf(headline, sizeof(headline), "%s%s%s",
@@ -1213,41 +1637,113 @@ void display_redraw(Bus *bus)
         // Position directly after the already written text
         int root_pos = 1 + strlen(D_HEADLINE) + 1;
         move(1, root_pos);
-        attron(COLOR_PAIR(RED_BLACK) | A_BOLD); // Red and bold
+        attron(theme[ATTR_ERROR] | A_BOLD); // Red and bold
         printw("(root)");
-        attroff(COLOR_PAIR(RED_BLACK) | A_BOLD);
+        attroff(theme[ATTR_ERROR] | A_BOLD);
     }
 
     display_services(bus);
     clrtobot();
     display_text_and_lines(bus);
+    display_search_prompt(bus);
+    refresh();
+
+    screen.valid = true;
+    screen.bus = bus;
+    screen.moves = view.moves;
+    screen.index_start = index_start;
+    screen.position = position;
+    screen.ndirty = 0;
+    screen.overflow = false;
+}
+
+/* Row of the list showing a unit, -1 if the unit is not on screen. Only
+ * exact while no unit moved since the last frame. */
+static int display_unit_row(Service *svc)
+{
+    int pos = svc->view_pos;
+
+    if (!screen.valid || pos < 0 || pos >= view.count || view.units[pos] != svc)
+        return -1;
+
+    pos -= screen.index_start;
+    return pos >= 0 && pos < screen.rows ? pos : -1;
+}
+
+/**
+ * Brings the screen up to date after units changed.
+ *
+ * If the rows still show the same units as in the last frame, only rows
+ * marked by display_redraw_row() and the unit counter are repainted.
+ * Otherwise, e.g. after a unit moved in the sort order or appeared, the
+ * whole screen is redrawn.
+ *
+ * @param bus The bus being displayed
+ */
+void display_refresh(Bus *bus)
+{
+    int spc = layout.header_row + 2;
+
+    display_view_update(bus);
+    if (!screen.valid || screen.overflow || screen.bus != bus || screen.moves != view.moves ||
+        screen.index_start != index_start || screen.position != position)
+    {
+        display_redraw(bus);
+        return;
+    }
+
+    // No unit moved, the rows still show the units they were marked for
+    for (int i = 0; i < screen.ndirty; i++)
+        display_service_line(view.units[index_start + screen.dirty[i]], screen.dirty[i], spc);
+    screen.ndirty = 0;
+
+    attron(theme[ATTR_TEXT]);
+    display_type_count(bus, spc - 2);
+    attrset(A_NORMAL);
+
+    display_search_prompt(bus);
     refresh();
 }
 
 /**
- * Refreshes the display row for the given service.
+ * Marks the display row of the given service for repainting.
  *
- * If the service is currently displayed on the screen, this function will
- * clear the row for the service and redraw it to ensure the display is
- * up-to-date.
+ * If the service is currently displayed on the screen, its row is
+ * repainted by the next display_refresh(), without the rest of the screen.
  *
  * @param svc The service to refresh the display row for.
  */
 void display_redraw_row(Service *svc)
 {
-    if (svc->ypos < 0)
+    int row = display_unit_row(svc);
+
+    if (row < 0)
+        return;
+
+    for (int i = 0; i < screen.ndirty; i++)
+    {
+        if (screen.dirty[i] == row)
+            return;
+    }
+
+    if (screen.ndirty == D_DIRTY_MAX)
+    {
+        screen.overflow = true;
         return;
+    }
+    screen.dirty[screen.ndirty++] = row;
+}
 
-    int curx, cury;
-    getyx(stdscr, cury, curx);
-    wmove(stdscr, svc->ypos, D_XLOAD);
-    wclrtoeol(stdscr);
-    wmove(stdscr, cury, curx);
+/* True if the unit has a row on screen */
+bool display_unit_shown(Service *svc)
+{
+    return display_unit_row(svc) >= 0;
 }
 
 void display_erase(void)
 {
     erase();
+    screen.valid = false;
 }
 
 /**
@@ -1308,34 +1804,55 @@ void reset_terminal_title(void)
 }
 
 /**
- * Signal handler for SIGWINCH (window change) events.
+ * Computes the layout of the screen for the given terminal size.
  *
- * This function is called when the terminal window is resized. It:
+ * @param rows The number of rows of the terminal.
+ * @param cols The number of columns of the terminal.
+ */
+static void display_layout_update(int rows, int cols)
+{
+    layout.id++;
+    layout.rows = rows;
+    layout.cols = cols;
+    layout.header_row = (size_t)cols < strlen(D_FUNCTIONS) + strlen(D_SERVICE_TYPES) + 2 ? 4 : 3;
+    calculate_columns(cols);
+}
+
+/**
+ * Handles SIGWINCH (window change) events.
+ *
+ * The signal is blocked and read from the event loop, so the screen is
+ * resized and redrawn like after any other event. It:
  * 1. Gets the new terminal dimensions
- * 2. Resizes the screen buffer and recalculates column widths
+ * 2. Resizes the screen buffer and recomputes the layout
  * 3. Redraws the entire display
  *
- * @param sig Signal number (unused)
+ * @param s The signal event source (unused)
+ * @param si The signal information (unused)
+ * @param userdata Unused
+ * @return 0 to keep the event source.
  */
-static void handle_winch(int sig)
+static int display_resized(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata)
 {
-    (void)sig;
+    (void)s;
+    (void)si;
+    (void)userdata;
     struct winsize size;
 
-    // Get new dimensions safely
+    // Get new dimensions
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1)
     {
         display_status_window("Error getting window size", "Error");
-        return;
+        return 0;
     }
 
     // Resize terminal and check for errors
     if (resizeterm(size.ws_row, size.ws_col) == ERR)
     {
-        return;
+        return 0;
     }
 
-    calculate_columns(size.ws_col);
+    display_layout_update(size.ws_row, size.ws_col);
 
     // Reset terminal properties
     keypad(stdscr, TRUE);
@@ -1357,19 +1874,43 @@ static void handle_winch(int sig)
     }
 
     refresh();
+    return 0;
+}
+
+/* Signals that end the program the way q does */
+static const int quit_signals[] = {SIGINT, SIGTERM, SIGHUP};
+
+/**
+ * Handles SIGINT, SIGTERM and SIGHUP.
+ *
+ * Leaves the event loop, so the ingestion thread is stopped and the
+ * terminal restored by the normal shutdown in main().
+ *
+ * @param s The signal event source
+ * @param si The signal information (unused)
+ * @param userdata Unused
+ * @return The result of sd_event_exit().
+ */
+static int display_quit(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata)
+{
+    (void)si;
+    (void)userdata;
+
+    return sd_event_exit(sd_event_source_get_event(s), 0);
 }
 
 /**
  * Initializes the display and event handling system.
  *
  * This function:
- * 1. Sets up SIGWINCH handler for terminal window resizing
- * 2. Initializes systemd event loop and IO event handling
+ * 1. Initializes systemd event loop and IO event handling
+ * 2. Routes SIGWINCH, SIGINT, SIGTERM and SIGHUP through the event loop
  * 3. Sets up ncurses display settings
  * 4. Configures color pairs for the UI
  *
  * The function handles:
  * - Window resize events through SIGWINCH
+ * - Requests to quit through SIGINT, SIGTERM and SIGHUP
  * - Keyboard input through epoll events
  * - Basic terminal display settings
  * - Color definitions for various UI elements
@@ -1382,27 +1923,46 @@ void display_init(void)
     int rc;
     Bus *bus = bus_currently_displayed();
 
-    // Signal-Handler for SIGWINCH
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = handle_winch;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
+    // initialize event loop
+    rc = sd_event_default(&event);
+    if (rc < 0)
+    {
+        sm_err_set("Cannot initialize event loop: %s\n", strerror(-rc));
+        return;
+    }
 
-    if (sigaction(SIGWINCH, &sa, NULL) == -1)
+    // Window changes and requests to quit are read from the event loop,
+    // never interrupting it
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGWINCH);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    // Only this thread, the ingestion thread blocks all signals already
+    rc = pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    if (rc != 0)
     {
-        sm_err_set("Cannot setup window change handler: %s\n", strerror(errno));
+        sm_err_set("Cannot setup signal handlers: %s\n", strerror(rc));
         return;
     }
 
-    // initialize event loop
-    rc = sd_event_default(&event);
+    rc = sd_event_add_signal(event, NULL, SIGWINCH, display_resized, NULL);
     if (rc < 0)
     {
-        sm_err_set("Cannot initialize event loop: %s\n", strerror(-rc));
+        sm_err_set("Cannot setup window change handler: %s\n", strerror(-rc));
         return;
     }
 
+    for (size_t i = 0; i < sizeof(quit_signals) / sizeof(quit_signals[0]); i++)
+    {
+        rc = sd_event_add_signal(event, NULL, quit_signals[i], display_quit, NULL);
+        if (rc < 0)
+        {
+            sm_err_set("Cannot setup %s handler: %s\n", strsignal(quit_signals[i]), strerror(-rc));
+            return;
+        }
+    }
+
     // initialize event handler
     rc = sd_event_add_io(event,
                          &event_source,
@@ -1427,6 +1987,9 @@ void display_init(void)
     euid = geteuid();
     start_time = service_now();
 
+    // UTF-8 unit descriptions need the character set of the terminal
+    setlocale(LC_CTYPE, "");
+
     // initialize ncurses
     initscr();
     raw();
@@ -1436,13 +1999,19 @@ void display_init(void)
     nodelay(stdscr, TRUE);
     set_escdelay(0);
 
-    // Only report mouse position, ignore clicks to prevent paste issues
-    mousemask(REPORT_MOUSE_POSITION, NULL);
-    printf("\033[?1003h\n"); // Extended mouse events enabled
+    // Nothing is drawn in the input window, so reading a key never refreshes the screen
+    input = newwin(1, 1, 0, 0);
+    untouchwin(input);
+    keypad(input, TRUE);
+    nodelay(input, TRUE);
 
-    struct winsize size;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
-    calculate_columns(size.ws_col);
+    // Only button presses, so moving the mouse sends nothing. ncurses picks
+    // the tracking mode (1000, and 1006 where the terminfo entry has it).
+    // Presses are reported at once instead of waiting to make out clicks.
+    mousemask(BUTTON1_PRESSED | BUTTON4_PRESSED | BUTTON5_PRESSED, NULL);
+    mouseinterval(0);
+
+    display_layout_update(LINES, COLS);
 
     start_color();
 
@@ -1532,9 +2101,9 @@ void display_status_window(const char *status, const char *title)
     wattroff(win, A_UNDERLINE);
 
     if (rows == 0)
-        wattron(win, COLOR_PAIR(RED_BLACK));
+        wattron(win, theme[ATTR_ERROR]);
     else
-        !strcmp(color_schemes[colorscheme].name, "Solarized Light") ? wattron(win, COLOR_PAIR(MAGENTA_BLACK)) : wattron(win, COLOR_PAIR(BLACK_WHITE));
+        wattron(win, theme[ATTR_TEXT]);
 
     line_start = status_cpy;
     while ((line_end = strchr(line_start, '\n')) != NULL)
@@ -1551,13 +2120,544 @@ void display_status_window(const char *status, const char *title)
     wrefresh(win);
     wgetch(win);
 
-    wattroff(win, COLOR_PAIR(RED_BLACK));
+    wattroff(win, theme[ATTR_ERROR]);
     wattroff(win, A_BOLD);
 
     delwin(win);
     refresh();
 }
 
+/**
+ * Displays a scrollable window with the provided text and title.
+ *
+ * Unlike display_status_window(), the text may be longer than the screen.
+ * Up/Down (jk), PageUp/PageDown, Home/End scroll the text, q, ESC or
+ * Return close the window.
+ *
+ * @param text The text to display, lines separated by newlines.
+ * @param title The title to display at the top of the window.
+ */
+void display_pager_window(const char *text, const char *title)
+{
+    const char **lines = NULL;
+    int *lengths = NULL;
+    int nlines = 0, maxlen = 0;
+    int maxy, maxx, height, width, visible;
+    int top = 0;
+    bool done = false;
+    const char *line_start = text;
+    WINDOW *win = NULL;
+
+    // Split the text into lines once, the window only references them
+    while (line_start && *line_start)
+    {
+        const char *line_end = strchr(line_start, '\n');
+        int len = line_end ? (int)(line_end - line_start) : (int)strlen(line_start);
+        const char **tmp_lines = realloc(lines, (nlines + 1) * sizeof(char *));
+        int *tmp_lengths = realloc(lengths, (nlines + 1) * sizeof(int));
+
+        if (tmp_lines)
+            lines = tmp_lines;
+        if (tmp_lengths)
+            lengths = tmp_lengths;
+        if (!tmp_lines || !tmp_lengths)
+            goto fin;
+
+        lines[nlines] = line_start;
+        lengths[nlines] = len;
+        nlines++;
+        if (len > maxlen)
+            maxlen = len;
+
+        line_start = line_end ? line_end + 1 : NULL;
+    }
+
+    getmaxyx(stdscr, maxy, maxx);
+
+    height = nlines + 2;
+    if (height > maxy - 2)
+        height = maxy - 2;
+    if (height < 3)
+        height = 3;
+
+    width = MAX(maxlen, (int)strlen(title)) + 4;
+    if (width > maxx - 2)
+        width = maxx - 2;
+
+    visible = height - 2;
+    win = newwin(height, width, (maxy - height) / 2, (maxx - width) / 2);
+    if (!win)
+        goto fin;
+    keypad(win, TRUE);
+
+    while (!done)
+    {
+        werase(win);
+        box(win, 0, 0);
+
+        wattron(win, A_BOLD | A_UNDERLINE);
+        mvwprintw(win, 0, (width / 2) - (strlen(title) / 2), "%s", title);
+        wattroff(win, A_UNDERLINE);
+
+        if (nlines > visible)
+            mvwprintw(win, height - 1, MAX(width - 20, 1), "[%d-%d/%d]", top + 1, MIN(top + visible, nlines), nlines);
+
+        wattron(win, theme[ATTR_TEXT]);
+        for (int i = 0; i < visible && top + i < nlines; i++)
+            mvwaddnstr(win, i + 1, 2, lines[top + i], MIN(lengths[top + i], width - 4));
+        wattroff(win, A_BOLD);
+
+        wrefresh(win);
+
+        switch (wgetch(win))
+        {
+        case KEY_UP:
+        case KEY_VI_U:
+            top--;
+            break;
+        case KEY_DOWN:
+        case KEY_VI_D:
+            top++;
+            break;
+        case KEY_PPAGE:
+            top -= visible;
+            break;
+        case KEY_NPAGE:
+        case KEY_SPACE:
+            top += visible;
+            break;
+        case KEY_HOME:
+        case 'g':
+            top = 0;
+            break;
+        case KEY_END:
+        case 'G':
+            top = nlines;
+            break;
+        case 'q':
+        case KEY_ESC:
+        case KEY_RETURN:
+            done = true;
+            break;
+        default:
+            break;
+        }
+
+        if (top > nlines - visible)
+            top = nlines - visible;
+        if (top < 0)
+            top = 0;
+    }
+
+    delwin(win);
+    touchwin(stdscr);
+    refresh();
+
+fin:
+    free(lines);
+    free(lengths);
+}
+
+/**
+ * Displays a scrollable list and lets the user pick one of its items.
+ *
+ * Up/Down (jk), PageUp/PageDown, Home/End move the selection, Return picks
+ * the selected item, q or ESC close the window.
+ *
+ * @param header A line shown above the items, e.g. column names.
+ * @param items The items to choose from, one line each.
+ * @param count The number of items.
+ * @param title The title to display at the top of the window.
+ * @param selected The index of the item selected initially.
+ * @return The index of the picked item, or -1 if the window was closed.
+ */
+int display_select_window(const char *header, char **items, int count, const char *title, int selected)
+{
+    int maxy, maxx, height, width, visible;
+    int maxlen = strlen(header);
+    int top = 0;
+    int picked = -1;
+    bool done = false;
+    WINDOW *win = NULL;
+
+    if (count <= 0)
+        return -1;
+
+    for (int i = 0; i < count; i++)
+        maxlen = MAX(maxlen, (int)strlen(items[i]));
+
+    getmaxyx(stdscr, maxy, maxx);
+
+    height = count + 4;
+    if (height > maxy - 2)
+        height = maxy - 2;
+    if (height < 5)
+        height = 5;
+
+    width = MAX(maxlen, (int)strlen(title)) + 4;
+    if (width > maxx - 2)
+        width = maxx - 2;
+
+    visible = height - 4;
+    win = newwin(height, width, (maxy - height) / 2, (maxx - width) / 2);
+    if (!win)
+        return -1;
+    keypad(win, TRUE);
+
+    if (selected >= count || selected < 0)
+        selected = 0;
+
+    while (!done)
+    {
+        if (selected < top)
+            top = selected;
+        if (selected >= top + visible)
+            top = selected - visible + 1;
+
+        werase(win);
+        box(win, 0, 0);
+
+        wattron(win, A_BOLD | A_UNDERLINE);
+        mvwprintw(win, 0, (width / 2) - (strlen(title) / 2), "%s", title);
+        wattroff(win, A_UNDERLINE);
+
+        wattron(win, theme[ATTR_TEXT]);
+        mvwaddnstr(win, 1, 2, header, width - 4);
+        mvwhline(win, 2, 1, ACS_HLINE, width - 2);
+        wattroff(win, A_BOLD);
+
+        for (int i = 0; i < visible && top + i < count; i++)
+        {
+            if (top + i == selected)
+                wattron(win, A_REVERSE | A_BOLD);
+            mvwaddnstr(win, i + 3, 2, items[top + i], width - 4);
+            if (top + i == selected)
+                wattroff(win, A_REVERSE | A_BOLD);
+        }
+
+        wrefresh(win);
+
+        switch (wgetch(win))
+        {
+        case KEY_UP:
+        case KEY_VI_U:
+            selected--;
+            break;
+        case KEY_DOWN:
+        case KEY_VI_D:
+            selected++;
+            break;
+        case KEY_PPAGE:
+            selected -= visible;
+            break;
+        case KEY_NPAGE:
+            selected += visible;
+            break;
+        case KEY_HOME:
+        case 'g':
+            selected = 0;
+            break;
+        case KEY_END:
+        case 'G':
+            selected = count - 1;
+            break;
+        case KEY_RETURN:
+            picked = selected;
+            done = true;
+            break;
+        case 'q':
+        case KEY_ESC:
+            done = true;
+            break;
+        default:
+            break;
+        }
+
+        if (selected >= count)
+            selected = count - 1;
+        if (selected < 0)
+            selected = 0;
+    }
+
+    delwin(win);
+    touchwin(stdscr);
+    refresh();
+    return picked;
+}
+
+/**
+ * Asks for a line of text in a small window.
+ *
+ * The buffer is edited in place, so it may be prefilled with the current
+ * value. Return accepts the text, ESC cancels.
+ *
+ * @param title The title to display at the top of the window.
+ * @param label The prompt shown in front of the text.
+ * @param buf The text to edit.
+ * @param size The size of the buffer.
+ * @return true if the text was accepted, false if cancelled.
+ */
+static bool display_input_window(const char *title, const char *label, char *buf, size_t size)
+{
+    int maxy, maxx, ch;
+    int width, offset, visible, start;
+    size_t cursor = strlen(buf);
+    bool accepted = false;
+    WINDOW *win = NULL;
+
+    getmaxyx(stdscr, maxy, maxx);
+    width = MIN(80, maxx - 2);
+    offset = 1 + strlen(label);
+    visible = width - offset - 2;
+    if (visible < 1)
+        return false;
+
+    win = newwin(3, width, (maxy - 3) / 2, (maxx - width) / 2);
+    if (!win)
+        return false;
+    keypad(win, TRUE);
+    curs_set(1);
+
+    while (true)
+    {
+        // Only the end of a text longer than the window is shown
+        start = cursor > (size_t)visible ? cursor - visible : 0;
+
+        werase(win);
+        box(win, 0, 0);
+        wattron(win, A_BOLD | A_UNDERLINE);
+        mvwprintw(win, 0, (width / 2) - (strlen(title) / 2), "%s", title);
+        wattroff(win, A_BOLD | A_UNDERLINE);
+        mvwprintw(win, 1, 1, "%s", label);
+        mvwaddnstr(win, 1, offset, &buf[start], visible);
+        wmove(win, 1, offset + (cursor - start));
+        wrefresh(win);
+
+        ch = wgetch(win);
+        if (ch == KEY_RETURN || ch == KEY_ENTER)
+        {
+            accepted = true;
+            break;
+        }
+        else if (ch == KEY_ESC)
+            break;
+        else if ((ch == KEY_BACKSPACE || ch == 127 || ch == 8) && cursor > 0)
+            buf[--cursor] = '\0';
+        else if (ch >= 32 && ch <= 126 && cursor + 1 < size)
+        {
+            buf[cursor++] = ch;
+            buf[cursor] = '\0';
+        }
+    }
+
+    curs_set(0);
+    delwin(win);
+    touchwin(stdscr);
+    refresh();
+    return accepted;
+}
+
+static void display_format_duration(char *buf, size_t sz, uint64_t usec)
+{
+    uint64_t sec = usec / 1000000;
+
+    if (sec >= 86400)
+        snprintf(buf, sz, "%" PRIu64 "d%02" PRIu64 "h%02" PRIu64 "m", sec / 86400, (sec % 86400) / 3600, (sec % 3600) / 60);
+    else if (sec >= 3600)
+        snprintf(buf, sz, "%" PRIu64 "h%02" PRIu64 "m%02" PRIu64 "s", sec / 3600, (sec % 3600) / 60, sec % 60);
+    else if (sec >= 60)
+        snprintf(buf, sz, "%" PRIu64 "m%02" PRIu64 "s", sec / 60, sec % 60);
+    else
+        snprintf(buf, sz, "%" PRIu64 ".%03" PRIu64 "s", sec, (usec % 1000000) / 1000);
+}
+
+/**
+ * Shows the past runs of a unit and the logs of the run picked by the user.
+ *
+ * Every run is listed with its start time, duration, result and the number
+ * of lines it logged. Picking a run opens its logs in the pager, closing
+ * the pager returns to the list.
+ *
+ * @param bus The bus the unit belongs to.
+ * @param svc The unit to show the runs of.
+ */
+static void display_invocations(Bus *bus, Service *svc)
+{
+    journal_invocation *invocations = NULL;
+    char **items = NULL;
+    size_t count = 0;
+    char title[300];
+    int picked = 0;
+    int rc;
+
+    // Needed to tell the current run apart from the finished ones
+    bus_invocation_id(bus, svc);
+
+    rc = journal_invocations(svc, &invocations, &count);
+    if (rc < 0)
+    {
+        display_status_window(strerror(-rc), "Invocations:");
+        return;
+    }
+
+    if (count == 0)
+    {
+        display_status_window("No runs of this unit found in the journal.", "Invocations:");
+        goto fin;
+    }
+
+    items = calloc(count, sizeof(char *));
+    if (!items)
+        goto fin;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        journal_invocation *inv = &invocations[i];
+        char strstamp[32] = {0};
+        char duration[32] = {0};
+        char line[160];
+        time_t t = inv->start / 1000000;
+
+        strftime(strstamp, sizeof(strstamp), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        display_format_duration(duration, sizeof(duration), inv->end - inv->start);
+        snprintf(line, sizeof(line), "%-19s %12s  %-16s %7" PRIu64 "  %s",
+                 strstamp, duration, inv->result, inv->lines, inv->id);
+
+        items[i] = strdup(line);
+        if (!items[i])
+            goto fin;
+    }
+
+    snprintf(title, sizeof(title), "Invocations of %s", svc->unit);
+
+    while (true)
+    {
+        char *logs = NULL;
+
+        picked = display_select_window("START                   DURATION  RESULT             LINES  INVOCATION ID",
+                                       items, count, title, picked);
+        if (picked < 0)
+            break;
+
+        logs = service_logs_invocation(invocations[picked].id, D_LOG_LINES);
+        display_pager_window(logs ? logs : "This run did not log anything.", items[picked]);
+        free(logs);
+    }
+
+fin:
+    if (items)
+    {
+        for (size_t i = 0; i < count; i++)
+            free(items[i]);
+        free(items);
+    }
+    free(invocations);
+}
+
+/**
+ * Shows the logs of all marked units, interleaved by time.
+ *
+ * If no unit is marked, the logs of the selected unit are shown.
+ *
+ * @param bus The bus the units belong to.
+ * @param svc The selected unit.
+ */
+static void display_merged_logs(Bus *bus, Service *svc)
+{
+    Service **marked = NULL;
+    char *logs = NULL;
+    char title[300];
+    int count = 0;
+
+    marked = services_marked(bus, &count);
+    if (count == 0)
+    {
+        free(marked);
+        marked = &svc;
+        count = 1;
+        snprintf(title, sizeof(title), "Logs of %s", svc->unit);
+    }
+    else
+        snprintf(title, sizeof(title), "Merged logs of %d units", count);
+
+    logs = service_logs_units(marked, count, D_LOG_LINES);
+    display_pager_window(logs ? logs : "No log lines found.", title);
+
+    free(logs);
+    if (marked != &svc)
+        free(marked);
+}
+
+/**
+ * Shows which units wrote the most to the journal during the current boot.
+ *
+ * The journal files are scanned in parallel in the background while a
+ * progress window is shown; ESC or q cancels the scan. The result is
+ * presented as a table sorted by message bytes.
+ *
+ * @param bus The bus whose units provide the descriptions.
+ */
+static void display_top_talkers(Bus *bus)
+{
+    journal_scan *scan = NULL;
+    journal_talker *talkers = NULL;
+    unit_snapshot *snap = NULL;
+    size_t count = 0;
+    char *table = NULL;
+    int done = 0, total = 0;
+    int rc;
+    WINDOW *win = NULL;
+
+    scan = journal_scan_start();
+    if (!scan)
+        return;
+
+    win = newwin(5, 60, LINES / 2 - 3, COLS / 2 - 30);
+    keypad(win, TRUE);
+    wtimeout(win, 100);
+
+    while (!journal_scan_done(scan))
+    {
+        int c;
+
+        journal_scan_progress(scan, &done, &total);
+
+        werase(win);
+        box(win, 0, 0);
+        wattron(win, A_BOLD | A_UNDERLINE);
+        mvwprintw(win, 0, 2, "Journal:");
+        wattroff(win, A_BOLD | A_UNDERLINE);
+        mvwprintw(win, 2, 2, "Scanning journal file %d of %d ...", done, total);
+        mvwprintw(win, 3, 2, "ESC: Cancel");
+        wrefresh(win);
+
+        c = wgetch(win);
+        if (c == KEY_ESC || c == 'q')
+            journal_scan_cancel(scan);
+    }
+
+    delwin(win);
+    touchwin(stdscr);
+    refresh();
+
+    rc = journal_scan_finish(scan, &talkers, &count);
+    if (rc == -ECANCELED)
+        return;
+    if (rc < 0)
+    {
+        display_status_window(strerror(-rc), "Journal:");
+        return;
+    }
+
+    snap = snapshot_acquire(bus);
+    table = journal_format_talkers(snap, talkers, count);
+    snapshot_release(snap);
+    display_pager_window(table ? table : "No journal entries found.", "Journal top talkers");
+
+    free(table);
+    journal_free_talkers(talkers, count);
+}
+
 void d_op(Bus *bus, Service *svc, enum operation mode, const char *txt)
 {
     (void)svc;
@@ -1570,7 +2670,7 @@ void d_op(Bus *bus, Service *svc, enum operation mode, const char *txt)
         box(win, 0, 0);
 
         // Enable red color and bold
-        wattron(win, COLOR_PAIR(RED_BLACK));
+        wattron(win, theme[ATTR_ERROR]);
         wattron(win, A_BOLD);
 
         mvwprintw(win, 0, 2, "Info:");
@@ -1579,7 +2679,7 @@ void d_op(Bus *bus, Service *svc, enum operation mode, const char *txt)
 
         // Disable bold and red color
         wattroff(win, A_BOLD);
-        wattroff(win, COLOR_PAIR(3));
+        wattroff(win, theme[ATTR_ERROR]);
 
         wrefresh(win);
 
@@ -1600,6 +2700,9 @@ void d_op(Bus *bus, Service *svc, enum operation mode, const char *txt)
             // End ncurses mode
             endwin();
 
+            // Programs started from here expect the signals blocked above again
+            pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
             // Attempt to reset the terminal
             if (system("reset") != 0)
                 perror("system reset failed");
@@ -1620,7 +2723,7 @@ void d_op(Bus *bus, Service *svc, enum operation mode, const char *txt)
         return;
     }
 
-    Service *temp_svc = service_nth(bus, position + index_start);
+    Service *temp_svc = display_nth(bus, position + index_start);
     if (!temp_svc)
     {
         display_status_window("No valid service selected.", "Error:");
@@ -1635,8 +2738,9 @@ void d_op(Bus *bus, Service *svc, enum operation mode, const char *txt)
 }
 
 /**
- * Sorts the services based on the currently highlighted header
- * and the corresponding sort direction.
+ * Sorts the list by the currently highlighted header and the
+ * corresponding sort direction. The order belongs to the view, so it
+ * holds across reloads and units changing state.
  *
  * @param bus The bus containing the services to be sorted
  */
@@ -1672,8 +2776,28 @@ static void sort_services_by_header(Bus *bus)
         return; // No sorting if no header is highlighted
     }
 
-    // Sort the services
-    service_sort(bus, compare_services);
+    // The view keeps this order until another column is chosen
+    view.order.keys[0].field = header_sort_fields[current_bold_header];
+    switch (current_bold_header)
+    {
+    case BOLD_UNIT:
+        view.order.keys[0].descending = unit_sort_direction == SORT_DESCENDING;
+        break;
+    case BOLD_STATE:
+        view.order.keys[0].descending = state_sort_direction == SORT_DESCENDING;
+        break;
+    case BOLD_ACTIVE:
+        view.order.keys[0].descending = active_sort_direction == SORT_DESCENDING;
+        break;
+    case BOLD_SUB:
+        view.order.keys[0].descending = sub_sort_direction == SORT_DESCENDING;
+        break;
+    default:
+        view.order.keys[0].descending = description_sort_direction == SORT_DESCENDING;
+        break;
+    }
+    view.order.count = 1;
+    view.valid = false;
 
     // Reset position
     index_start = 0;
@@ -1683,3 +2807,38 @@ static void sort_services_by_header(Bus *bus)
     current_bold_header = BOLD_NONE;
     header_highlighting_initialized = false;
 }
+
+/**
+ * Adds the highlighted column as a further sort key, deciding where the
+ * columns before it are equal. If the column already is a sort key, its
+ * direction flips instead. The header stays highlighted so more columns
+ * can be added.
+ */
+static void display_sort_add_header(void)
+{
+    enum sort_field field;
+    int i;
+
+    if (current_bold_header == BOLD_NONE)
+        return;
+
+    field = header_sort_fields[current_bold_header];
+    for (i = 0; i < view.order.count; i++)
+    {
+        if (view.order.keys[i].field == field)
+            break;
+    }
+
+    if (i < view.order.count)
+        view.order.keys[i].descending = !view.order.keys[i].descending;
+    else if (view.order.count == SORT_MAX_KEYS)
+    {
+        display_status_window("At most three columns can be sorted by.\nReturn sorts by the highlighted column alone.", "Sort");
+        return;
+    }
+    else
+        view.order.keys[view.order.count++] = (sort_key){field, false};
+
+    view.valid = false;
+}
+
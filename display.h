@@ -15,6 +15,7 @@
 #define KEY_VI_D 106
 
 #define D_ESCOFF_MS 300000LLU
+#define D_LOG_LINES 1000
 #define D_VERSION "1.7.6"
 #define D_FUNCTIONS "F1:START F2:STOP F3:RESTART F4:ENABLE F5:DISABLE F6:MASK F7:UNMASK F8:RELOAD"
 #define D_SERVICE_TYPES "a:ALL d:DEV i:SLICE s:SERVICE o:SOCKET t:TARGET r:TIMER m:MOUNT c:SCOPE n:AMOUNT w:SWAP p:PATH H:SSHOT"
@@ -32,7 +33,6 @@ extern int D_XDESCRIPTION;
         position = 0;    \
         index_start = 0; \
         mode = m;        \
-        clear();         \
     }
 
 // Color pairs
@@ -48,6 +48,7 @@ extern int D_XDESCRIPTION;
 #define WHITE_RED 9
 #define BLACK_GREEN 10
 #define RED_YELLOW 11
+#define SELECTION 12 // Colors of the selected row, set by the scheme
 
 extern char *program_name;
 
@@ -66,8 +67,13 @@ void display_erase(void);
 void display_init(void);
 void display_redraw(Bus *bus);
 void display_redraw_row(Service *svc);
+bool display_unit_shown(Service *svc);
+void display_refresh(Bus *bus);
+void display_unit_changed(Bus *bus, Service *svc);
 void display_set_bus_type(enum bus_type);
 void display_status_window(const char *status, const char *title);
+void display_pager_window(const char *text, const char *title);
+int display_select_window(const char *header, char **items, int count, const char *title, int selected);
 void d_op(Bus *bus, Service *svc, enum operation mode, const char *txt);
 void set_color_scheme(int scheme);
 void reset_terminal_title(void);
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include "sm_err.h"
+#include "service.h"
+#include "filter.h"
+#include "ingest.h"
+#include "dump.h"
+
+static const char *dump_formats[] = {"json", "ndjson", "csv"};
+
+/* The fields of a dumped unit, in output order */
+static const char *dump_fields[] = {"unit", "type", "load", "active", "sub", "state", "description"};
+#define DUMP_FIELDS (sizeof(dump_fields) / sizeof(dump_fields[0]))
+
+/**
+ * Looks up an output format by name.
+ *
+ * @param name The name given on the command line, e.g. "ndjson".
+ * @return The dump_format, or -1 if the name is unknown.
+ */
+int dump_format_of(const char *name)
+{
+    for (size_t i = 0; i < sizeof(dump_formats) / sizeof(dump_formats[0]); i++)
+        if (strcasecmp(name, dump_formats[i]) == 0)
+            return i;
+    return -1;
+}
+
+/* Length of the valid UTF-8 sequence at p, 0 if it is not one. Overlong
+ * forms, surrogates and code points past U+10FFFF are not valid. */
+static int dump_utf8_length(const unsigned char *p)
+{
+    int len;
+    unsigned char min = 0x80, max = 0xbf;
+
+    if (*p >= 0xc2 && *p <= 0xdf)
+        len = 2;
+    else if (*p >= 0xe0 && *p <= 0xef)
+    {
+        len = 3;
+        if (*p == 0xe0)
+            min = 0xa0;
+        else if (*p == 0xed)
+            max = 0x9f;
+    }
+    else if (*p >= 0xf0 && *p <= 0xf4)
+    {
+        len = 4;
+        if (*p == 0xf0)
+            min = 0x90;
+        else if (*p == 0xf4)
+            max = 0x8f;
+    }
+    else
+        return 0;
+
+    // The bounds only apply to the second byte
+    if (p[1] < min || p[1] > max)
+        return 0;
+    for (int i = 2; i < len; i++)
+        if (p[i] < 0x80 || p[i] > 0xbf)
+            return 0;
+    return len;
+}
+
+/* Writes a JSON string literal, escaping quotes, backslashes and control
+ * characters. Bytes that are not valid UTF-8 become U+FFFD. */
+static void dump_json_string(FILE *out, const char *str)
+{
+    putc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+        {
+            putc('\\', out);
+            putc(*p, out);
+        }
+        else if (*p < 0x20 || *p == 0x7f)
+            fprintf(out, "\\u%04x", *p);
+        else if (*p < 0x80)
+            putc(*p, out);
+        else
+        {
+            int len = dump_utf8_length(p);
+
+            if (!len)
+            {
+                fputs("\\ufffd", out);
+                continue;
+            }
+            fwrite(p, 1, len, out);
+            p += len - 1;
+        }
+    }
+    putc('"', out);
+}
+
+/* Writes a CSV field, quoted as RFC 4180 asks if it holds a separator, quote or line break */
+static void dump_csv_string(FILE *out, const char *str)
+{
+    if (!str[strcspn(str, ",\"\r\n")])
+    {
+        fputs(str, out);
+        return;
+    }
+
+    putc('"', out);
+    for (const char *p = str; *p; p++)
+    {
+        if (*p == '"')
+            putc('"', out);
+        putc(*p, out);
+    }
+    putc('"', out);
+}
+
+/**
+ * Writes one unit in the given format.
+ *
+ * @param out The stream to write to.
+ * @param format The output format.
+ * @param svc The unit, only its listed fields are used.
+ * @param first Whether this is the first unit written, for the JSON separators.
+ */
+static void dump_unit(FILE *out, enum dump_format format, Service *svc, bool first)
+{
+    const char *values[DUMP_FIELDS] = {
+        svc->unit,
+        service_string_type(svc->type),
+        svc->load,
+        svc->active,
+        svc->sub,
+        svc->unit_file_state,
+        svc->description,
+    };
+
+    if (format == DUMP_JSON)
+        fputs(first ? "\n  " : ",\n  ", out);
+
+    for (size_t i = 0; i < DUMP_FIELDS; i++)
+    {
+        const char *value = values[i] ? values[i] : "";
+
+        if (format == DUMP_CSV)
+        {
+            if (i)
+                putc(',', out);
+            dump_csv_string(out, value);
+            continue;
+        }
+
+        fputs(i ? ", " : "{", out);
+        dump_json_string(out, dump_fields[i]);
+        fputs(": ", out);
+        dump_json_string(out, value);
+    }
+
+    if (format != DUMP_CSV)
+        putc('}', out);
+    if (format != DUMP_JSON)
+        putc('\n', out);
+}
+
+/**
+ * Lists the units of a bus once and writes them to stdout, without ncurses.
+ *
+ * Units are read by the ingestion thread, which connects to this bus only,
+ * and written as its records arrive, so at most a queue of units is held
+ * in memory however many there are.
+ *
+ * @param bus The bus to list the units of.
+ * @param format The output format.
+ * @param expression A filter expression as for the F key, or NULL for all units.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the filter is invalid or the
+ * output could not be written.
+ */
+int dump_units(enum bus_type bus, enum dump_format format, const char *expression)
+{
+    char error[FILTER_MAX_LENGTH];
+    filter_expr *f = NULL;
+    bool listed = false;
+    bool first = true;
+    int fd;
+
+    if (expression && expression[strspn(expression, " ")] != '\0')
+    {
+        f = filter_compile(expression, error, sizeof(error));
+        if (!f)
+        {
+            fprintf(stderr, "Invalid filter: %s\n", error);
+            return EXIT_FAILURE;
+        }
+    }
+
+    fd = ingest_start(INGEST_BUS(bus), BUS_ALL_TYPES);
+    if (fd < 0)
+        sm_err_set("Cannot start reading units: %s\n", strerror(-fd));
+
+    if (format == DUMP_JSON)
+        fputs("[", stdout);
+    else if (format == DUMP_CSV)
+    {
+        for (size_t i = 0; i < DUMP_FIELDS; i++)
+            printf("%s%s", i ? "," : "", dump_fields[i]);
+        putchar('\n');
+    }
+
+    while (!listed)
+    {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        uint64_t wakeups;
+        ingest_record *rec;
+        const char *failure;
+
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            sm_err_set("Cannot wait for units: %s\n", strerror(errno));
+        if (read(fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+            sm_err_set("Cannot read unit updates: %s\n", strerror(errno));
+
+        failure = ingest_failure();
+        if (failure)
+            sm_err_set("%s\n", failure);
+
+        while (!listed && (rec = ingest_pop()))
+        {
+            if (rec->bus == bus && rec->kind == INGEST_UNIT)
+            {
+                Service svc = {0};
+
+                svc.unit = (char *)rec->unit;
+                svc.description = (char *)rec->description;
+                svc.load = rec->load;
+                svc.active = rec->active;
+                svc.sub = rec->sub;
+                svc.unit_file_state = rec->file_state;
+                svc.type = service_type_of(rec->unit);
+
+                if (!f || filter_matches(f, &svc))
+                {
+                    dump_unit(stdout, format, &svc, first);
+                    first = false;
+                }
+            }
+            else if (rec->bus == bus && rec->kind == INGEST_LISTED)
+                listed = true;
+            free(rec);
+        }
+
+        // Hand each batch on at once, a slow bus should not hold back the reader
+        fflush(stdout);
+    }
+
+    if (format == DUMP_JSON)
+        fputs(first ? "]\n" : "\n]\n", stdout);
+
+    ingest_stop();
+    filter_free(f);
+    if (fflush(stdout) == EOF || ferror(stdout))
+    {
+        fprintf(stderr, "Cannot write units: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
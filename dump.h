@@ -0,0 +1,14 @@
+#ifndef _DUMP_H_
+#define _DUMP_H_
+#include "bus.h"
+
+enum dump_format
+{
+    DUMP_JSON,
+    DUMP_NDJSON,
+    DUMP_CSV
+};
+
+int dump_format_of(const char *name);
+int dump_units(enum bus_type bus, enum dump_format format, const char *expression);
+#endif
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "filter.h"
+
+static const char *filter_field_names[MAX_FILTER_FIELDS][2] = {
+    {"type", NULL},
+    {"name", "unit"},
+    {"desc", "description"},
+    {"load", NULL},
+    {"active", NULL},
+    {"sub", NULL},
+    {"state", "file"}};
+
+/* Bumped for every compiled filter, 0 marks a unit result as stale */
+static uint32_t filter_generation = 0;
+
+/* Bumped whenever the fields of any unit change */
+static unsigned long filter_change_count = 0;
+
+static const char *filter_field_value(Service *svc, enum filter_field field)
+{
+    switch (field)
+    {
+    case FILTER_NAME:
+        return svc->unit;
+    case FILTER_DESCRIPTION:
+        return svc->description;
+    case FILTER_LOAD:
+        return svc->load;
+    case FILTER_ACTIVE:
+        return svc->active;
+    case FILTER_SUB:
+        return svc->sub;
+    case FILTER_STATE:
+        return svc->unit_file_state;
+    default:
+        return NULL;
+    }
+}
+
+static bool filter_term_holds(filter_term *term, Service *svc)
+{
+    const char *value = NULL;
+    bool holds = false;
+
+    if (term->field == FILTER_TYPE)
+        holds = (term->types & (1u << svc->type)) != 0;
+    else
+    {
+        value = filter_field_value(svc, term->field);
+        if (!value)
+            value = "";
+
+        if (term->op == FILTER_MATCH)
+            holds = regexec(&term->regex, value, 0, NULL, 0) == 0;
+        else
+        {
+            for (int i = 0; i < term->value_count && !holds; i++)
+                holds = strcasecmp(term->values[i], value) == 0;
+        }
+    }
+
+    return holds != term->negate;
+}
+
+/* Cheap comparisons go first so regexes only run on units that survive them */
+static int filter_term_cost(const filter_term *term)
+{
+    if (term->field == FILTER_TYPE)
+        return 0;
+    return term->op == FILTER_EQUAL ? 1 : 2;
+}
+
+static int compare_terms(const void *a, const void *b)
+{
+    return filter_term_cost((const filter_term *)a) - filter_term_cost((const filter_term *)b);
+}
+
+/* Split the next whitespace separated token off the expression, double
+ * quotes keep whitespace within a token. Returns NULL at the end of the
+ * expression, a token of only quotes is empty but not the end. */
+static const char *filter_next_token(const char *p, char *token, size_t size)
+{
+    bool quoted = false;
+    size_t n = 0;
+
+    while (isspace((unsigned char)*p))
+        p++;
+    if (!*p)
+        return NULL;
+
+    for (; *p && (quoted || !isspace((unsigned char)*p)); p++)
+    {
+        if (*p == '"')
+        {
+            quoted = !quoted;
+            continue;
+        }
+        if (n + 1 < size)
+            token[n++] = *p;
+    }
+
+    token[n] = '\0';
+    return p;
+}
+
+static int filter_term_values(filter_term *term, const char *values)
+{
+    const char *p = values;
+
+    term->value_count = 1;
+    for (const char *c = values; *c; c++)
+    {
+        if (*c == ',')
+            term->value_count++;
+    }
+
+    term->values = calloc(term->value_count, sizeof(char *));
+    if (!term->values)
+        return -1;
+
+    for (int i = 0; i < term->value_count; i++)
+    {
+        size_t len = strcspn(p, ",");
+
+        term->values[i] = strndup(p, len);
+        if (!term->values[i])
+            return -1;
+        p += len + (p[len] == ',');
+    }
+    return 0;
+}
+
+static int filter_term_types(filter_term *term, char *error, size_t size)
+{
+    for (int i = 0; i < term->value_count; i++)
+    {
+        int t;
+
+        for (t = 0; t < MAX_TYPES; t++)
+        {
+            if (strcasecmp(term->values[i], service_string_type(t)) == 0)
+                break;
+        }
+
+        if (t == MAX_TYPES)
+        {
+            snprintf(error, size, "Unknown unit type '%s'", term->values[i]);
+            return -1;
+        }
+
+        term->types |= t == ALL ? ~0u : 1u << t;
+    }
+    return 0;
+}
+
+static int filter_parse_term(filter_term *term, const char *token, char *error, size_t size)
+{
+    size_t len = strcspn(token, "=~!");
+    const char *value = token + len;
+    int field, rc;
+
+    if (!*value || len == 0)
+    {
+        snprintf(error, size, "Expected field=value or field~regex, got '%s'", token);
+        return -1;
+    }
+
+    for (field = 0; field < MAX_FILTER_FIELDS; field++)
+    {
+        const char *name = filter_field_names[field][0];
+        const char *alias = filter_field_names[field][1];
+
+        if ((strlen(name) == len && strncasecmp(token, name, len) == 0) ||
+            (alias && strlen(alias) == len && strncasecmp(token, alias, len) == 0))
+            break;
+    }
+
+    if (field == MAX_FILTER_FIELDS)
+    {
+        snprintf(error, size, "Unknown field '%.*s'", (int)len, token);
+        return -1;
+    }
+    term->field = field;
+
+    if (*value == '!')
+    {
+        term->negate = true;
+        value++;
+    }
+
+    if (*value != '=' && *value != '~')
+    {
+        snprintf(error, size, "Expected = or ~ after '%.*s'", (int)len, token);
+        return -1;
+    }
+
+    if (term->field == FILTER_TYPE && *value == '~')
+    {
+        snprintf(error, size, "Unit types can only be compared with =");
+        return -1;
+    }
+
+    if (*value++ == '~')
+    {
+        rc = regcomp(&term->regex, value, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+        if (rc != 0)
+        {
+            char reason[128];
+
+            regerror(rc, &term->regex, reason, sizeof(reason));
+            snprintf(error, size, "Bad regex '%s': %s", value, reason);
+            return -1;
+        }
+
+        // Only set once compiled, so that filter_free knows to release it
+        term->op = FILTER_MATCH;
+        return 0;
+    }
+
+    if (filter_term_values(term, value) < 0)
+    {
+        snprintf(error, size, "Out of memory");
+        return -1;
+    }
+
+    if (term->field == FILTER_TYPE)
+        return filter_term_types(term, error, size);
+    return 0;
+}
+
+/**
+ * Compiles a filter expression such as
+ * "type=service active=failed name~^nginx desc~cache".
+ *
+ * Terms are separated by whitespace and must all hold. A term compares a
+ * field with "=" against a comma separated list of values, or with "~"
+ * against an extended regular expression, both ignoring case. Prefixing
+ * the operator with "!" negates the term.
+ *
+ * @param expression The expression to compile
+ * @param error Receives a description of the problem if compiling fails
+ * @param size The size of the error buffer
+ * @return The compiled filter, or NULL on error
+ */
+filter_expr *filter_compile(const char *expression, char *error, size_t size)
+{
+    char token[FILTER_MAX_LENGTH + 1];
+    const char *p = expression;
+    filter_expr *f = NULL;
+    int max = 0;
+
+    f = calloc(1, sizeof(filter_expr));
+    if (!f || !(f->expression = strdup(expression)))
+        goto oom;
+
+    // Every term needs at least two characters and a separator
+    max = strlen(expression) / 2 + 1;
+    f->terms = calloc(max, sizeof(filter_term));
+    if (!f->terms)
+        goto oom;
+
+    while (true)
+    {
+        p = filter_next_token(p, token, sizeof(token));
+        if (!p)
+            break;
+
+        if (!token[0])
+        {
+            snprintf(error, size, "Empty term, expected field=value or field~regex");
+            filter_free(f);
+            return NULL;
+        }
+
+        if (filter_parse_term(&f->terms[f->count++], token, error, size) < 0)
+        {
+            filter_free(f);
+            return NULL;
+        }
+    }
+
+    if (f->count == 0)
+    {
+        snprintf(error, size, "Empty filter expression");
+        filter_free(f);
+        return NULL;
+    }
+
+    qsort(f->terms, f->count, sizeof(filter_term), compare_terms);
+
+    if (++filter_generation == 0)
+        filter_generation = 1;
+    f->generation = filter_generation;
+    return f;
+
+oom:
+    snprintf(error, size, "Out of memory");
+    filter_free(f);
+    return NULL;
+}
+
+/**
+ * Tests whether a unit matches a filter.
+ *
+ * The result is cached in the unit and only evaluated again once the unit
+ * has been invalidated or a different filter is used.
+ *
+ * @param f The compiled filter
+ * @param svc The unit to test
+ * @return true if all terms hold for the unit
+ */
+bool filter_matches(filter_expr *f, Service *svc)
+{
+    if (svc->filter_generation == f->generation)
+        return svc->filter_match;
+
+    svc->filter_match = true;
+    for (int i = 0; i < f->count && svc->filter_match; i++)
+        svc->filter_match = filter_term_holds(&f->terms[i], svc);
+
+    svc->filter_generation = f->generation;
+    return svc->filter_match;
+}
+
+/**
+ * Marks the cached filter result and composed row of a unit as stale.
+ *
+ * Must be called whenever a field that can be filtered on changes, which
+ * are all fields shown in the list.
+ *
+ * @param svc The unit whose fields changed
+ */
+void filter_invalidate(Service *svc)
+{
+    svc->filter_generation = 0;
+    svc->row_layout = 0;
+    filter_change_count++;
+}
+
+/**
+ * Returns a counter that moves whenever any unit was invalidated, so views
+ * built from filter results know when to rebuild.
+ */
+unsigned long filter_changes(void)
+{
+    return filter_change_count;
+}
+
+void filter_free(filter_expr *f)
+{
+    if (!f)
+        return;
+
+    for (int i = 0; i < f->count; i++)
+    {
+        filter_term *term = &f->terms[i];
+
+        if (term->op == FILTER_MATCH)
+            regfree(&term->regex);
+        for (int v = 0; v < term->value_count; v++)
+            free(term->values[v]);
+        free(term->values);
+    }
+
+    free(f->terms);
+    free(f->expression);
+    free(f);
+}
@@ -0,0 +1,56 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <regex.h>
+#include "service.h"
+
+#define FILTER_MAX_LENGTH 256
+
+enum filter_field
+{
+    FILTER_TYPE,
+    FILTER_NAME,
+    FILTER_DESCRIPTION,
+    FILTER_LOAD,
+    FILTER_ACTIVE,
+    FILTER_SUB,
+    FILTER_STATE,
+    MAX_FILTER_FIELDS
+};
+
+enum filter_op
+{
+    FILTER_EQUAL,
+    FILTER_MATCH
+};
+
+/* One field=value or field~regex condition of an expression */
+typedef struct filter_term
+{
+    enum filter_field field;
+    enum filter_op op;
+    bool negate;
+    uint32_t types; // For FILTER_TYPE, a bit per service_type
+    char **values;  // For FILTER_EQUAL, alternatives separated by commas
+    int value_count;
+    regex_t regex; // For FILTER_MATCH
+} filter_term;
+
+/* A compiled expression, all of its terms must hold for a unit to match */
+typedef struct filter_expr
+{
+    char *expression;
+    uint32_t generation;
+    filter_term *terms;
+    int count;
+} filter_expr;
+
+filter_expr *filter_compile(const char *expression, char *error, size_t size);
+bool filter_matches(filter_expr *f, Service *svc);
+void filter_invalidate(Service *svc);
+unsigned long filter_changes(void);
+void filter_free(filter_expr *f);
+
+#endif
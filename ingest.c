@@ -0,0 +1,692 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+#include "config.h"
+#include "ingest.h"
+
+#define INGEST_UNIT_PATH SD_OPATH "/unit"
+
+/* State changes of every unit, systemd only emits them once subscribed */
+#define INGEST_MATCH_CHANGED                                \
+    "type='signal',"                                        \
+    "sender='" SD_DESTINATION "',"                          \
+    "path_namespace='" INGEST_UNIT_PATH "',"                \
+    "interface='org.freedesktop.DBus.Properties',"          \
+    "member='PropertiesChanged',"                           \
+    "arg0='" SD_IFACE("Unit") "'"
+
+struct ingest_bus
+{
+    enum bus_type type;
+    sd_bus *bus;
+    uint32_t types;  // Types listed so far, listed again after a reload
+    uint32_t wanted; // Types the UI asked for and not listed yet
+};
+
+/* The worker is the only producer and the UI thread the only consumer of
+ * the ring, so head and tail each have a single writer */
+static struct
+{
+    pthread_t thread;
+    sd_event *event;
+    int ui_fd;     // Readable while records wait for the UI
+    int worker_fd; // Readable when the UI asked for more types or a stop
+    bool started;
+    bool stopping; // Set by ingest_stop(), the worker leaves at the next chance
+    bool failed;
+    char error[256];
+    uint32_t head; // Written by the worker only
+    uint32_t tail; // Written by the UI only
+    ingest_record *ring[INGEST_QUEUE_SIZE];
+    int nbuses;
+    struct ingest_bus buses[2]; // The buses followed, in bus_type order
+} ingest = {.ui_fd = -1, .worker_fd = -1};
+
+/* Tells the UI records are waiting */
+static void ingest_flush(void)
+{
+    uint64_t one = 1;
+
+    if (write(ingest.ui_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return;
+}
+
+/* Records the reason the worker stops and stops it. The UI reports it, the
+ * worker must not touch the terminal. */
+static int ingest_fail(int rc, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(ingest.error, sizeof(ingest.error), fmt, ap);
+    va_end(ap);
+
+    __atomic_store_n(&ingest.failed, true, __ATOMIC_RELEASE);
+    ingest_flush();
+
+    if (ingest.event)
+        sd_event_exit(ingest.event, rc);
+    return rc < 0 ? rc : -EIO;
+}
+
+/**
+ * Creates a record holding copies of the given strings.
+ *
+ * @param kind The kind of update.
+ * @param bus The bus the update is for.
+ * @param flag Prune for listings, the reloading state for reloads.
+ * @param strings The unit, description, load, active, sub, object and
+ * file_state strings, NULL for those the record does not carry.
+ * @return The record, or NULL if out of memory.
+ */
+static ingest_record *ingest_record_new(enum ingest_kind kind, enum bus_type bus, bool flag, const char *strings[7])
+{
+    ingest_record *rec = NULL;
+    const char **fields[7];
+    size_t lens[7], size = 0;
+    char *p;
+
+    for (int i = 0; i < 7; i++)
+    {
+        lens[i] = strings[i] ? strlen(strings[i]) + 1 : 0;
+        size += lens[i];
+    }
+
+    rec = malloc(sizeof(ingest_record) + size);
+    if (!rec)
+        return NULL;
+
+    memset(rec, 0, sizeof(ingest_record));
+    rec->kind = kind;
+    rec->bus = bus;
+    rec->flag = flag;
+
+    fields[0] = &rec->unit;
+    fields[1] = &rec->description;
+    fields[2] = &rec->load;
+    fields[3] = &rec->active;
+    fields[4] = &rec->sub;
+    fields[5] = &rec->object;
+    fields[6] = &rec->file_state;
+
+    p = rec->data;
+    for (int i = 0; i < 7; i++)
+    {
+        if (!strings[i])
+            continue;
+        memcpy(p, strings[i], lens[i]);
+        *fields[i] = p;
+        p += lens[i];
+    }
+
+    return rec;
+}
+
+/* Hands a record to the UI, waiting for room if it is behind. The UI only
+ * learns about it with the next ingest_flush(). */
+static int ingest_push(ingest_record *rec)
+{
+    struct timespec backoff = {0, 1000000};
+    uint32_t head = ingest.head;
+
+    if (!rec)
+        return ingest_fail(-ENOMEM, "Cannot queue unit update: %s", strerror(ENOMEM));
+
+    while (head - __atomic_load_n(&ingest.tail, __ATOMIC_ACQUIRE) >= INGEST_QUEUE_SIZE)
+    {
+        // The UI stopped draining, give up instead of waiting for it
+        if (__atomic_load_n(&ingest.stopping, __ATOMIC_ACQUIRE))
+        {
+            free(rec);
+            return -ECANCELED;
+        }
+        ingest_flush();
+        nanosleep(&backoff, NULL);
+    }
+
+    ingest.ring[head & (INGEST_QUEUE_SIZE - 1)] = rec;
+    __atomic_store_n(&ingest.head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int ingest_push_marker(enum ingest_kind kind, struct ingest_bus *ib, bool flag)
+{
+    const char *none[7] = {NULL};
+
+    return ingest_push(ingest_record_new(kind, ib->type, flag, none));
+}
+
+/**
+ * Reads one entry of a unit listing and queues it.
+ *
+ * The unit file state is not part of the listing and is fetched per unit,
+ * which is the slow part of a listing and why it runs off the UI thread.
+ *
+ * @param ib The bus the listing came from.
+ * @param reply The listing, positioned at the next entry.
+ * @return 1 if an entry was read, 0 at the end of the list, negative on error.
+ */
+static int ingest_unit(struct ingest_bus *ib, sd_bus_message *reply)
+{
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    const char *unit, *load, *active, *sub, *description, *object;
+    char *file_state = NULL;
+    int rc;
+
+    rc = sd_bus_message_read(reply, "(ssssssouso)",
+                             &unit,
+                             &description,
+                             &load,
+                             &active,
+                             &sub,
+                             NULL,
+                             &object,
+                             NULL,
+                             NULL,
+                             NULL);
+    if (rc < 0)
+        return ingest_fail(rc, "Cannot ready service from service list: %s", strerror(-rc));
+
+    /* There are no more entries in the list */
+    if (rc == 0)
+        return 0;
+
+    /* Abandon the listing, the UI no longer takes records */
+    if (__atomic_load_n(&ingest.stopping, __ATOMIC_ACQUIRE))
+        return -ECANCELED;
+
+    /* Excluded units never get a record */
+    if (config_unit_excluded(unit))
+        return 1;
+
+    rc = sd_bus_get_property_string(ib->bus,
+                                    SD_DESTINATION,
+                                    object,
+                                    SD_IFACE("Unit"),
+                                    "UnitFileState",
+                                    &error,
+                                    &file_state);
+    if (sd_bus_error_is_set(&error))
+        rc = ingest_fail(-EIO, "Cannot fetch object property: %s", error.message);
+    else if (rc < 0)
+        rc = ingest_fail(rc, "Cannot fetch object property: %s", strerror(-rc));
+    else
+        rc = ingest_push(ingest_record_new(INGEST_UNIT, ib->type, false,
+                                           (const char *[7]){unit, description, load, active, sub, object, file_state}));
+
+    free(file_state);
+    sd_bus_error_free(&error);
+    return rc < 0 ? rc : 1;
+}
+
+/**
+ * Lists the units of the given types and queues them for the UI.
+ *
+ * The listing is framed by INGEST_LISTING and INGEST_LISTED records. The UI
+ * only sweeps units missing from it if prune is set.
+ *
+ * @param ib The bus to list the units of.
+ * @param types The unit types to list, a bit per service_type.
+ * @param prune Whether units not listed are swept, only sound if all
+ * previously listed types are listed again.
+ * @return 0 on success, negative value on error.
+ */
+static int ingest_list_units(struct ingest_bus *ib, uint32_t types, bool prune)
+{
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *request = NULL;
+    sd_bus_message *reply = NULL;
+    char globs[MAX_TYPES][16];
+    char *patterns[MAX_TYPES + 1] = {NULL};
+    char *no_states[] = {NULL};
+    int rc = 0, n = 0;
+
+    if (types == BUS_ALL_TYPES)
+    {
+        rc = sd_bus_call_method(ib->bus,
+                                SD_DESTINATION,
+                                SD_OPATH,
+                                SD_IFACE("Manager"),
+                                "ListUnits",
+                                &error,
+                                &reply,
+                                NULL);
+    }
+    else
+    {
+        for (int i = ALL + 1; i < UNKNOWN; i++)
+        {
+            if (!(types & BUS_TYPE(i)))
+                continue;
+            snprintf(globs[n], sizeof(globs[n]), "*.%s", service_string_type(i));
+            patterns[n] = globs[n];
+            n++;
+        }
+
+        rc = sd_bus_message_new_method_call(ib->bus,
+                                            &request,
+                                            SD_DESTINATION,
+                                            SD_OPATH,
+                                            SD_IFACE("Manager"),
+                                            "ListUnitsByPatterns");
+        if (rc >= 0)
+            rc = sd_bus_message_append_strv(request, no_states);
+        if (rc >= 0)
+            rc = sd_bus_message_append_strv(request, patterns);
+        if (rc >= 0)
+            rc = sd_bus_call(ib->bus, request, 0, &error, &reply);
+    }
+
+    if (sd_bus_error_is_set(&error))
+    {
+        rc = ingest_fail(-EIO, "Error retrieving unit list from DBUS: %s", error.message);
+        goto fin;
+    }
+
+    if (rc < 0)
+    {
+        rc = ingest_fail(rc, "Cannot call DBUS request to fetch all units: %s", strerror(-rc));
+        goto fin;
+    }
+
+    rc = sd_bus_message_enter_container(reply, 'a', "(ssssssouso)");
+    if (rc < 0)
+    {
+        rc = ingest_fail(rc, "Cannot enter into array fetching all units: %s", strerror(-rc));
+        goto fin;
+    }
+
+    rc = ingest_push_marker(INGEST_LISTING, ib, prune);
+    while (rc >= 0)
+    {
+        rc = ingest_unit(ib, reply);
+        if (rc <= 0)
+            break;
+    }
+    sd_bus_message_exit_container(reply);
+
+    if (rc >= 0)
+        rc = ingest_push_marker(INGEST_LISTED, ib, prune);
+    ingest_flush();
+
+fin:
+    sd_bus_message_unref(request);
+    sd_bus_message_unref(reply);
+    sd_bus_error_free(&error);
+    return rc;
+}
+
+/* Queues the active and sub state of a unit whose properties changed */
+static int ingest_unit_changed(sd_bus_message *reply, void *data, sd_bus_error *err)
+{
+    struct ingest_bus *ib = (struct ingest_bus *)data;
+    const char *iface = NULL, *key = NULL, *active = NULL, *sub = NULL;
+    char *unit = NULL;
+    int rc;
+
+    /* Message format: sa{sv}as */
+
+    if (sd_bus_error_is_set(err))
+        return ingest_fail(-EIO, "Changed unit callback failed: %s", err->message);
+
+    /* The unit name is encoded in the object path */
+    rc = sd_bus_path_decode(sd_bus_message_get_path(reply), INGEST_UNIT_PATH, &unit);
+    if (rc <= 0)
+        return 0;
+
+    /* The match covers every unit, skip those never listed before parsing */
+    if (!(ib->types & BUS_TYPE(service_type_of(unit))) || config_unit_excluded(unit))
+        goto fin;
+
+    /* s: Interface name */
+    rc = sd_bus_message_read(reply, "s", &iface);
+    if (rc < 0)
+    {
+        rc = ingest_fail(rc, "Cannot read dbus messge: %s", strerror(-rc));
+        goto fin;
+    }
+
+    /* If the interface is not a unit, we dont care */
+    if (strcmp(iface, SD_IFACE("Unit")) != 0)
+        goto fin;
+
+    /* a: Array of dictionaries */
+    rc = sd_bus_message_enter_container(reply, 'a', "{sv}");
+    if (rc < 0)
+    {
+        rc = ingest_fail(rc, "Cannot read array in dbus message: %s", strerror(-rc));
+        goto fin;
+    }
+
+    while (true)
+    {
+        /* {..}: Dictionary itself */
+        rc = sd_bus_message_enter_container(reply, 'e', "sv");
+        if (rc < 0)
+        {
+            rc = ingest_fail(rc, "Cannot read dict item in dbus message: %s", strerror(-rc));
+            goto fin;
+        }
+
+        /* No more array entries to read */
+        if (rc == 0)
+            break;
+
+        rc = sd_bus_message_read(reply, "s", &key);
+        if (rc < 0)
+        {
+            rc = ingest_fail(rc, "Cannot read dictionary key item from array: %s", strerror(-rc));
+            goto fin;
+        }
+
+        /* v: Variant, always a string for the states */
+        if (strcmp(key, "ActiveState") == 0)
+            rc = sd_bus_message_read(reply, "v", "s", &active);
+        else if (strcmp(key, "SubState") == 0)
+            rc = sd_bus_message_read(reply, "v", "s", &sub);
+        else
+            rc = sd_bus_message_skip(reply, NULL);
+        if (rc < 0)
+        {
+            rc = ingest_fail(rc, "Cannot fetch value from dictionary: %s", strerror(-rc));
+            goto fin;
+        }
+
+        sd_bus_message_exit_container(reply);
+    }
+
+    sd_bus_message_exit_container(reply);
+
+    if (active || sub)
+    {
+        rc = ingest_push(ingest_record_new(INGEST_CHANGED, ib->type, false,
+                                           (const char *[7]){unit, NULL, NULL, active, sub, NULL, NULL}));
+        ingest_flush();
+    }
+
+fin:
+    free(unit);
+    return rc < 0 ? rc : 0;
+}
+
+/* Callback which is invoked when a reload event is captured */
+static int ingest_reloaded(sd_bus_message *reply, void *data, sd_bus_error *err)
+{
+    struct ingest_bus *ib = (struct ingest_bus *)data;
+    int reloading = 0;
+    int rc;
+
+    if (sd_bus_error_is_set(err))
+        return ingest_fail(-EIO, "Remove unit callback failed: %s", err->message);
+
+    rc = sd_bus_message_read(reply, "b", &reloading);
+    if (rc < 0)
+        return ingest_fail(rc, "Cannot read dbus mesasge: %s", strerror(-rc));
+
+    rc = ingest_push_marker(INGEST_RELOADING, ib, reloading);
+    if (rc < 0)
+        return rc;
+
+    // The reload emits a boolean if it starts set to true, once the reload
+    // finishes the callback emits again, with the boolean set to false
+    if (reloading)
+    {
+        ingest_flush();
+        return 0;
+    }
+
+    return ingest_list_units(ib, ib->types, true);
+}
+
+/* Lists the types the UI asked for since the last wakeup, or leaves the
+ * event loop if the UI is stopping */
+static int ingest_woken(sd_event_source *s, int fd, uint32_t revents, void *data)
+{
+    uint64_t wakeups;
+    int rc = 0;
+
+    (void)s;
+    (void)revents;
+    (void)data;
+
+    if (read(fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN)
+        return ingest_fail(-errno, "Cannot read ingestion wakeup: %s", strerror(errno));
+
+    if (__atomic_load_n(&ingest.stopping, __ATOMIC_ACQUIRE))
+        return sd_event_exit(ingest.event, 0);
+
+    for (int i = 0; i < ingest.nbuses && rc >= 0; i++)
+    {
+        struct ingest_bus *ib = &ingest.buses[i];
+        uint32_t types = __atomic_exchange_n(&ib->wanted, 0, __ATOMIC_ACQUIRE);
+
+        if (!types)
+            continue;
+
+        // Units of other types are untouched, so nothing can be pruned
+        ib->types |= types;
+        rc = ingest_list_units(ib, types, false);
+    }
+
+    return rc;
+}
+
+/**
+ * Connects the worker to a bus and subscribes to unit changes.
+ *
+ * The worker owns this connection, the UI keeps its own one for operations
+ * and status queries, as an sd_bus must only be used by one thread.
+ *
+ * @param ib The bus to connect.
+ * @return 0 on success, negative value on error.
+ */
+static int ingest_setup_bus(struct ingest_bus *ib)
+{
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    int rc;
+
+    if (ib->type == SYSTEM)
+        rc = sd_bus_open_system(&ib->bus);
+    else
+        rc = sd_bus_open_user(&ib->bus);
+    if (rc < 0)
+        return ingest_fail(rc, "Cannot initialize DBUS: %s", strerror(-rc));
+
+    rc = sd_bus_attach_event(ib->bus, ingest.event, SD_EVENT_PRIORITY_NORMAL);
+    if (rc < 0)
+        return ingest_fail(rc, "Unable to attach bus to event loop: %s", strerror(-rc));
+
+    // Now subscribe to events in systemd
+    rc = sd_bus_call_method(ib->bus,
+                            SD_DESTINATION,
+                            SD_OPATH,
+                            SD_IFACE("Manager"),
+                            "Subscribe",
+                            &error,
+                            NULL,
+                            NULL);
+    if (sd_bus_error_is_set(&error))
+        rc = ingest_fail(-EIO, "Cannot subcribe to systemd dbus events: %s", error.message);
+    else if (rc < 0)
+        rc = ingest_fail(rc, "Cannot subcribe to systemd dbus events: %s", strerror(-rc));
+    sd_bus_error_free(&error);
+    if (rc < 0)
+        return rc;
+
+    // We care about the reloading signal/event
+    rc = sd_bus_match_signal(ib->bus,
+                             NULL,
+                             SD_DESTINATION,
+                             SD_OPATH,
+                             SD_IFACE("Manager"),
+                             "Reloading",
+                             ingest_reloaded,
+                             (void *)ib);
+    if (rc < 0)
+        return ingest_fail(rc, "Cannot register interest in daemon reloads: %s", strerror(-rc));
+
+    // A single match covers every unit, listed now or later
+    rc = sd_bus_add_match(ib->bus, NULL, INGEST_MATCH_CHANGED, ingest_unit_changed, (void *)ib);
+    if (rc < 0)
+        return ingest_fail(rc, "Cannot register interest changed units: %s", strerror(-rc));
+
+    return 0;
+}
+
+static void *ingest_worker(void *data)
+{
+    int rc;
+
+    (void)data;
+
+    rc = sd_event_new(&ingest.event);
+    if (rc < 0)
+    {
+        ingest_fail(rc, "Cannot create ingestion event loop: %s", strerror(-rc));
+        return NULL;
+    }
+
+    rc = sd_event_add_io(ingest.event, NULL, ingest.worker_fd, EPOLLIN, ingest_woken, NULL);
+    if (rc < 0)
+    {
+        ingest_fail(rc, "Cannot initialize event handler: %s", strerror(-rc));
+        goto fin;
+    }
+
+    for (int i = 0; i < ingest.nbuses && rc >= 0; i++)
+        rc = ingest_setup_bus(&ingest.buses[i]);
+
+    for (int i = 0; i < ingest.nbuses && rc >= 0; i++)
+        rc = ingest_list_units(&ingest.buses[i], ingest.buses[i].types, true);
+
+    if (rc >= 0)
+        sd_event_loop(ingest.event);
+
+fin:
+    for (int i = 0; i < ingest.nbuses; i++)
+        ingest.buses[i].bus = sd_bus_flush_close_unref(ingest.buses[i].bus);
+    ingest.event = sd_event_unref(ingest.event);
+    return NULL;
+}
+
+/**
+ * Starts the thread that reads units and their changes off the buses.
+ *
+ * The worker lists the units, follows reloads and state changes and queues
+ * them as ingest_record entries. It never waits on the UI unless the queue
+ * is full, and the UI never waits on it or on the bus.
+ *
+ * @param buses The buses to follow, a bit per bus_type, see INGEST_BUS().
+ * @param types The unit types to list first, a bit per service_type.
+ * @return A descriptor that is readable while records are queued, or a
+ * negative error code.
+ */
+int ingest_start(uint32_t buses, uint32_t types)
+{
+    sigset_t all, old;
+    int rc;
+
+    ingest.nbuses = 0;
+    for (int i = SYSTEM; i <= USER; i++)
+    {
+        if (!(buses & INGEST_BUS(i)))
+            continue;
+        ingest.buses[ingest.nbuses].type = i;
+        ingest.buses[ingest.nbuses].types = types;
+        ingest.nbuses++;
+    }
+
+    ingest.ui_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ingest.worker_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ingest.ui_fd < 0 || ingest.worker_fd < 0)
+        return -errno;
+
+    /* The worker must never run our signal handlers */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&ingest.thread, NULL, ingest_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+        return -rc;
+
+    ingest.started = true;
+    return ingest.ui_fd;
+}
+
+/**
+ * Stops the worker and waits for it to finish.
+ *
+ * Must be called before anything the worker reads, such as the exclude
+ * patterns, is freed. A listing in progress is abandoned, a bus call in
+ * flight is waited for, and the records still queued are freed. Calling it
+ * again, or without ingest_start(), does nothing.
+ */
+void ingest_stop(void)
+{
+    ingest_record *rec;
+    uint64_t one = 1;
+
+    if (!ingest.started || __atomic_exchange_n(&ingest.stopping, true, __ATOMIC_ACQ_REL))
+        return;
+
+    // The event loop belongs to the worker, it exits it once woken
+    if (write(ingest.worker_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return;
+    pthread_join(ingest.thread, NULL);
+
+    while ((rec = ingest_pop()))
+        free(rec);
+}
+
+/* Number of records queued for the UI */
+uint32_t ingest_pending(void)
+{
+    return __atomic_load_n(&ingest.head, __ATOMIC_ACQUIRE) - ingest.tail;
+}
+
+/* Takes the oldest queued record, the caller frees it, NULL if none */
+ingest_record *ingest_pop(void)
+{
+    ingest_record *rec = NULL;
+    uint32_t tail = ingest.tail;
+
+    if (__atomic_load_n(&ingest.head, __ATOMIC_ACQUIRE) == tail)
+        return NULL;
+
+    rec = ingest.ring[tail & (INGEST_QUEUE_SIZE - 1)];
+    __atomic_store_n(&ingest.tail, tail + 1, __ATOMIC_RELEASE);
+    return rec;
+}
+
+/* The reason the worker stopped, NULL while it runs */
+const char *ingest_failure(void)
+{
+    if (!__atomic_load_n(&ingest.failed, __ATOMIC_ACQUIRE))
+        return NULL;
+    return ingest.error;
+}
+
+/* Asks the worker to list units of more types, without pruning */
+void ingest_request_types(enum bus_type bus, uint32_t types)
+{
+    uint64_t one = 1;
+    int i = 0;
+
+    while (i < ingest.nbuses && ingest.buses[i].type != bus)
+        i++;
+    if (i == ingest.nbuses || !types)
+        return;
+
+    __atomic_fetch_or(&ingest.buses[i].wanted, types, __ATOMIC_RELEASE);
+    if (write(ingest.worker_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return;
+}
@@ -0,0 +1,46 @@
+#ifndef _INGEST_H_
+#define _INGEST_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include "bus.h"
+
+/* Records in flight between the ingestion thread and the UI, a power of 2 */
+#define INGEST_QUEUE_SIZE 8192
+
+/* A bus to follow, for ingest_start() */
+#define INGEST_BUS(b) (1u << (b))
+
+enum ingest_kind
+{
+    INGEST_LISTING, // A listing of units starts
+    INGEST_UNIT,    // A unit of the current listing
+    INGEST_LISTED,  // The listing is complete
+    INGEST_CHANGED, // The active or sub state of a unit changed
+    INGEST_RELOADING
+};
+
+/* An update parsed by the ingestion thread. The strings point into data and
+ * are plain copies, the UI interns them, as pools and atoms are not shared
+ * between threads. Strings a record does not carry are NULL. */
+typedef struct ingest_record
+{
+    enum ingest_kind kind;
+    enum bus_type bus;
+    bool flag; // Prune for listings, the reloading state for INGEST_RELOADING
+    const char *unit;
+    const char *description;
+    const char *load;
+    const char *active;
+    const char *sub;
+    const char *object;
+    const char *file_state;
+    char data[];
+} ingest_record;
+
+int ingest_start(uint32_t buses, uint32_t types);
+void ingest_stop(void);
+ingest_record *ingest_pop(void);
+uint32_t ingest_pending(void);
+const char *ingest_failure(void);
+void ingest_request_types(enum bus_type bus, uint32_t types);
+#endif
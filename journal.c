@@ -0,0 +1,756 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <systemd/sd-journal.h>
+#include <systemd/sd-id128.h>
+#include "sm_err.h"
+#include "journal.h"
+#include "service.h"
+
+#define JOURNAL_NO_UNIT "(no unit)"
+
+/* Message ID the manager logs when a unit run ended successfully */
+#define JOURNAL_UNIT_SUCCESS "MESSAGE_ID=7ad2d189f7e94e70a38c781354912448"
+
+static const char *journal_dirs[] = {
+    "/var/log/journal",
+    "/run/log/journal",
+    NULL};
+
+/* Open addressing table mapping a unit name to its aggregated volume */
+struct talker_table
+{
+    journal_talker *slots;
+    size_t size;
+    size_t used;
+};
+
+struct journal_worker
+{
+    journal_scan *scan;
+    pthread_t thread;
+    struct talker_table table;
+};
+
+struct journal_scan
+{
+    char **files;
+    int nfiles;
+    int next;
+    int done;
+    int running;
+    int cancelled;
+    char boot_match[64];
+    int nworkers;
+    struct journal_worker workers[JOURNAL_MAX_WORKERS];
+};
+
+/* FNV-1a, good enough for unit names */
+static uint64_t journal_hash(const char *s, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int talker_table_grow(struct talker_table *t)
+{
+    size_t size = t->size ? t->size * 2 : 256;
+    journal_talker *slots = calloc(size, sizeof(journal_talker));
+
+    if (!slots)
+        return -ENOMEM;
+
+    for (size_t i = 0; i < t->size; i++)
+    {
+        journal_talker *old = &t->slots[i];
+        if (!old->unit)
+            continue;
+
+        size_t pos = journal_hash(old->unit, strlen(old->unit)) & (size - 1);
+        while (slots[pos].unit)
+            pos = (pos + 1) & (size - 1);
+        slots[pos] = *old;
+    }
+
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/* Find the entry for this unit, creating it if it does not exist yet */
+static journal_talker *talker_table_get(struct talker_table *t, const char *unit, size_t len)
+{
+    size_t pos;
+
+    if ((t->used + 1) * 10 >= t->size * 7 && talker_table_grow(t) < 0)
+        return NULL;
+
+    pos = journal_hash(unit, len) & (t->size - 1);
+    while (t->slots[pos].unit)
+    {
+        if (strncmp(t->slots[pos].unit, unit, len) == 0 && t->slots[pos].unit[len] == '\0')
+            return &t->slots[pos];
+        pos = (pos + 1) & (t->size - 1);
+    }
+
+    t->slots[pos].unit = strndup(unit, len);
+    if (!t->slots[pos].unit)
+        return NULL;
+    t->used++;
+    return &t->slots[pos];
+}
+
+static void talker_table_free(struct talker_table *t)
+{
+    for (size_t i = 0; i < t->size; i++)
+        free(t->slots[i].unit);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+static bool journal_file_name(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len > 8 && strcmp(name + len - 8, ".journal") == 0)
+        return true;
+    if (len > 9 && strcmp(name + len - 9, ".journal~") == 0)
+        return true;
+    return false;
+}
+
+/* Collect every journal file of this machine, both persistent and volatile */
+static int journal_collect_files(journal_scan *scan)
+{
+    sd_id128_t machine;
+    char id[SD_ID128_STRING_MAX];
+    int rc;
+
+    rc = sd_id128_get_machine(&machine);
+    if (rc < 0)
+        return rc;
+    sd_id128_to_string(machine, id);
+
+    for (int d = 0; journal_dirs[d]; d++)
+    {
+        char dir[PATH_MAX];
+        DIR *dp;
+        struct dirent *de;
+
+        snprintf(dir, sizeof(dir), "%s/%s", journal_dirs[d], id);
+        dp = opendir(dir);
+        if (!dp)
+            continue;
+
+        while ((de = readdir(dp)))
+        {
+            char **files;
+
+            if (!journal_file_name(de->d_name))
+                continue;
+
+            files = realloc(scan->files, (scan->nfiles + 1) * sizeof(char *));
+            if (!files)
+            {
+                closedir(dp);
+                return -ENOMEM;
+            }
+            scan->files = files;
+
+            size_t len = strlen(dir) + strlen(de->d_name) + 2;
+            scan->files[scan->nfiles] = malloc(len);
+            if (!scan->files[scan->nfiles])
+            {
+                closedir(dp);
+                return -ENOMEM;
+            }
+            snprintf(scan->files[scan->nfiles], len, "%s/%s", dir, de->d_name);
+            scan->nfiles++;
+        }
+        closedir(dp);
+    }
+
+    return 0;
+}
+
+/* Aggregate all entries of the current boot found in a single journal file */
+static void journal_scan_file(journal_scan *scan, struct talker_table *table, const char *path)
+{
+    const char *paths[] = {path, NULL};
+    sd_journal *j = NULL;
+    int r;
+
+    /* Files we may not read (other users' journals) are silently skipped */
+    r = sd_journal_open_files(&j, paths, 0);
+    if (r < 0)
+        return;
+
+    sd_journal_add_match(j, scan->boot_match, 0);
+
+    SD_JOURNAL_FOREACH(j)
+    {
+        const char *val = NULL;
+        const char *unit = JOURNAL_NO_UNIT;
+        size_t len = strlen(JOURNAL_NO_UNIT);
+        size_t sz = 0;
+        uint64_t bytes = 0;
+        journal_talker *t;
+
+        if (__atomic_load_n(&scan->cancelled, __ATOMIC_RELAXED))
+            break;
+
+        r = sd_journal_get_data(j, "MESSAGE", (const void **)&val, &sz);
+        if (r >= 0 && sz > 8)
+            bytes = sz - 8;
+
+        r = sd_journal_get_data(j, "_SYSTEMD_UNIT", (const void **)&val, &sz);
+        if (r >= 0 && sz > 14)
+        {
+            unit = val + 14;
+            len = sz - 14;
+        }
+
+        t = talker_table_get(table, unit, len);
+        if (!t)
+            break;
+
+        t->lines++;
+        t->bytes += bytes;
+    }
+
+    sd_journal_close(j);
+}
+
+static void *journal_scan_worker(void *data)
+{
+    struct journal_worker *w = (struct journal_worker *)data;
+    journal_scan *scan = w->scan;
+
+    while (!__atomic_load_n(&scan->cancelled, __ATOMIC_RELAXED))
+    {
+        int i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED);
+        if (i >= scan->nfiles)
+            break;
+
+        journal_scan_file(scan, &w->table, scan->files[i]);
+        __atomic_fetch_add(&scan->done, 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_fetch_sub(&scan->running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void journal_scan_free(journal_scan *scan)
+{
+    if (!scan)
+        return;
+
+    for (int i = 0; i < scan->nworkers; i++)
+        talker_table_free(&scan->workers[i].table);
+    for (int i = 0; i < scan->nfiles; i++)
+        free(scan->files[i]);
+    free(scan->files);
+    free(scan);
+}
+
+/**
+ * Starts a parallel scan of the current boot's journal.
+ *
+ * Every journal file of the machine is handed to one of up to
+ * JOURNAL_MAX_WORKERS threads, each of which opens it on its own with
+ * sd_journal_open_files() and counts lines and message bytes per
+ * _SYSTEMD_UNIT. The scan runs in the background, use journal_scan_done()
+ * to poll it and journal_scan_finish() to collect the result.
+ *
+ * @return The running scan, or NULL on failure.
+ */
+journal_scan *journal_scan_start(void)
+{
+    journal_scan *scan = NULL;
+    sd_id128_t boot;
+    char id[SD_ID128_STRING_MAX];
+    sigset_t all, old;
+    long ncpu;
+    int rc;
+
+    scan = calloc(1, sizeof(journal_scan));
+    if (!scan)
+    {
+        sm_err_window("Cannot start journal scan: %s", strerror(errno));
+        return NULL;
+    }
+
+    rc = sd_id128_get_boot(&boot);
+    if (rc < 0)
+    {
+        sm_err_window("Cannot determine current boot: %s", strerror(-rc));
+        goto fail;
+    }
+    snprintf(scan->boot_match, sizeof(scan->boot_match), "_BOOT_ID=%s", sd_id128_to_string(boot, id));
+
+    rc = journal_collect_files(scan);
+    if (rc < 0)
+    {
+        sm_err_window("Cannot enumerate journal files: %s", strerror(-rc));
+        goto fail;
+    }
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    scan->nworkers = scan->nfiles;
+    if (ncpu > 0 && scan->nworkers > ncpu)
+        scan->nworkers = ncpu;
+    if (scan->nworkers > JOURNAL_MAX_WORKERS)
+        scan->nworkers = JOURNAL_MAX_WORKERS;
+
+    /* Workers must never run our signal handlers */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for (int i = 0; i < scan->nworkers; i++)
+    {
+        struct journal_worker *w = &scan->workers[i];
+
+        w->scan = scan;
+        __atomic_fetch_add(&scan->running, 1, __ATOMIC_RELAXED);
+        rc = pthread_create(&w->thread, NULL, journal_scan_worker, w);
+        if (rc != 0)
+        {
+            __atomic_fetch_sub(&scan->running, 1, __ATOMIC_RELAXED);
+            scan->nworkers = i;
+            break;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (scan->nworkers == 0 && scan->nfiles > 0)
+    {
+        sm_err_window("Cannot start journal scan workers: %s", strerror(rc));
+        goto fail;
+    }
+
+    return scan;
+
+fail:
+    journal_scan_free(scan);
+    return NULL;
+}
+
+/* True once every worker has finished its share of the files */
+bool journal_scan_done(journal_scan *scan)
+{
+    return __atomic_load_n(&scan->running, __ATOMIC_ACQUIRE) == 0;
+}
+
+/* Number of journal files processed so far, and in total */
+void journal_scan_progress(journal_scan *scan, int *done, int *total)
+{
+    *done = __atomic_load_n(&scan->done, __ATOMIC_ACQUIRE);
+    *total = scan->nfiles;
+}
+
+/* Ask all workers to stop at the next journal entry */
+void journal_scan_cancel(journal_scan *scan)
+{
+    __atomic_store_n(&scan->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+static int compare_talkers(const void *a, const void *b)
+{
+    const journal_talker *t1 = (const journal_talker *)a;
+    const journal_talker *t2 = (const journal_talker *)b;
+
+    if (t1->bytes != t2->bytes)
+        return t1->bytes < t2->bytes ? 1 : -1;
+    if (t1->lines != t2->lines)
+        return t1->lines < t2->lines ? 1 : -1;
+    return strcmp(t1->unit, t2->unit);
+}
+
+/**
+ * Waits for a scan to end, merges the per-worker results and frees the scan.
+ *
+ * @param scan The scan started by journal_scan_start().
+ * @param talkers Receives an array of units sorted by journal bytes, largest first.
+ * @param count Receives the number of entries in talkers.
+ * @return 0 on success, -ECANCELED if the scan was cancelled, or another negative error code.
+ */
+int journal_scan_finish(journal_scan *scan, journal_talker **talkers, size_t *count)
+{
+    struct talker_table merged = {0};
+    journal_talker *out = NULL;
+    size_t n = 0;
+    int rc = 0;
+
+    *talkers = NULL;
+    *count = 0;
+
+    for (int i = 0; i < scan->nworkers; i++)
+        pthread_join(scan->workers[i].thread, NULL);
+
+    if (scan->cancelled)
+    {
+        rc = -ECANCELED;
+        goto fin;
+    }
+
+    for (int i = 0; i < scan->nworkers; i++)
+    {
+        struct talker_table *t = &scan->workers[i].table;
+
+        for (size_t s = 0; s < t->size; s++)
+        {
+            journal_talker *src = &t->slots[s];
+            journal_talker *dst;
+
+            if (!src->unit)
+                continue;
+
+            dst = talker_table_get(&merged, src->unit, strlen(src->unit));
+            if (!dst)
+            {
+                rc = -ENOMEM;
+                goto fin;
+            }
+            dst->lines += src->lines;
+            dst->bytes += src->bytes;
+        }
+    }
+
+    out = calloc(merged.used ? merged.used : 1, sizeof(journal_talker));
+    if (!out)
+    {
+        rc = -ENOMEM;
+        goto fin;
+    }
+
+    /* Move the entries out of the table, it no longer owns the names */
+    for (size_t s = 0; s < merged.size; s++)
+    {
+        if (!merged.slots[s].unit)
+            continue;
+        out[n++] = merged.slots[s];
+        merged.slots[s].unit = NULL;
+    }
+
+    qsort(out, n, sizeof(journal_talker), compare_talkers);
+    *talkers = out;
+    *count = n;
+
+fin:
+    talker_table_free(&merged);
+    journal_scan_free(scan);
+    return rc;
+}
+
+void journal_free_talkers(journal_talker *talkers, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(talkers[i].unit);
+    free(talkers);
+}
+
+static void journal_format_bytes(char *buf, size_t sz, uint64_t bytes)
+{
+    if (bytes >= 1073741824ULL)
+        snprintf(buf, sz, "%.1fG", (double)bytes / 1073741824.0);
+    else if (bytes >= 1048576ULL)
+        snprintf(buf, sz, "%.1fM", (double)bytes / 1048576.0);
+    else if (bytes >= 1024ULL)
+        snprintf(buf, sz, "%.1fK", (double)bytes / 1024.0);
+    else
+        snprintf(buf, sz, "%" PRIu64 "B", bytes);
+}
+
+/**
+ * Formats the top talkers as a table, taking unit descriptions from the
+ * services already known on the bus.
+ *
+ * @param snap The units of the bus providing the descriptions, may be NULL.
+ * @param talkers The sorted talkers returned by journal_scan_finish().
+ * @param count The number of talkers.
+ * @return A dynamically allocated string containing the table, or NULL on failure.
+ */
+char *journal_format_talkers(const unit_snapshot *snap, journal_talker *talkers, size_t count)
+{
+    char *out = NULL;
+    size_t sz = 0;
+    uint64_t lines = 0, bytes = 0;
+    char strbytes[16];
+    FILE *fp;
+
+    fp = open_memstream(&out, &sz);
+    if (!fp)
+        return NULL;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        lines += talkers[i].lines;
+        bytes += talkers[i].bytes;
+    }
+
+    journal_format_bytes(strbytes, sizeof(strbytes), bytes);
+    fprintf(fp, "Current boot: %" PRIu64 " lines, %s in messages from %zu units\n\n", lines, strbytes, count);
+    fprintf(fp, "%-48s %10s %9s %6s  %s\n", "UNIT", "LINES", "BYTES", "SHARE", "DESCRIPTION");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        journal_talker *t = &talkers[i];
+        const snapshot_unit *u = snapshot_find(snap, t->unit);
+
+        journal_format_bytes(strbytes, sizeof(strbytes), t->bytes);
+        fprintf(fp, "%-48.48s %10" PRIu64 " %9s %5.1f%%  %s\n",
+                t->unit,
+                t->lines,
+                strbytes,
+                bytes ? (double)t->bytes * 100.0 / (double)bytes : 0.0,
+                u ? u->description : "");
+    }
+
+    fclose(fp);
+    return out;
+}
+
+/* Add the match "field=value" to the journal */
+static int journal_add_match_value(sd_journal *j, const char *field, const char *value)
+{
+    char match[512];
+
+    snprintf(match, sizeof(match), "%s=%s", field, value);
+    return sd_journal_add_match(j, match, 0);
+}
+
+/* Open addressing table mapping an invocation ID to its run */
+struct invocation_table
+{
+    journal_invocation *slots;
+    size_t size;
+    size_t used;
+};
+
+static int invocation_table_grow(struct invocation_table *t)
+{
+    size_t size = t->size ? t->size * 2 : 64;
+    journal_invocation *slots = calloc(size, sizeof(journal_invocation));
+
+    if (!slots)
+        return -ENOMEM;
+
+    for (size_t i = 0; i < t->size; i++)
+    {
+        journal_invocation *old = &t->slots[i];
+        if (!old->id[0])
+            continue;
+
+        size_t pos = journal_hash(old->id, 32) & (size - 1);
+        while (slots[pos].id[0])
+            pos = (pos + 1) & (size - 1);
+        slots[pos] = *old;
+    }
+
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/* Find the run with this 32 character ID, creating it if it does not exist yet */
+static journal_invocation *invocation_table_get(struct invocation_table *t, const char *id)
+{
+    size_t pos;
+
+    if ((t->used + 1) * 10 >= t->size * 7 && invocation_table_grow(t) < 0)
+        return NULL;
+
+    pos = journal_hash(id, 32) & (t->size - 1);
+    while (t->slots[pos].id[0])
+    {
+        if (memcmp(t->slots[pos].id, id, 32) == 0)
+            return &t->slots[pos];
+        pos = (pos + 1) & (t->size - 1);
+    }
+
+    memcpy(t->slots[pos].id, id, 32);
+    t->used++;
+    return &t->slots[pos];
+}
+
+/* The 32 character value of field in the current entry, NULL if it has none */
+static const char *journal_entry_id(sd_journal *j, const char *field)
+{
+    const char *val = NULL;
+    size_t sz = 0;
+    size_t prefix = strlen(field) + 1;
+
+    if (sd_journal_get_data(j, field, (const void **)&val, &sz) < 0 || sz != prefix + 32)
+        return NULL;
+    return val + prefix;
+}
+
+/* Whether the current entry has field set to value */
+static bool journal_entry_is(sd_journal *j, const char *field, const char *value)
+{
+    const char *val = NULL;
+    size_t sz = 0;
+    size_t prefix = strlen(field) + 1;
+
+    return sd_journal_get_data(j, field, (const void **)&val, &sz) >= 0 &&
+           sz == prefix + strlen(value) && strncmp(val + prefix, value, sz - prefix) == 0;
+}
+
+/**
+ * Adds the current journal entry to the run of unit it belongs to.
+ *
+ * Messages of the system and user manager about the unit carry the run in
+ * INVOCATION_ID or USER_INVOCATION_ID and give its result, a failed run
+ * has a UNIT_RESULT. Output of the unit itself carries the run in
+ * _SYSTEMD_INVOCATION_ID and is counted as a line.
+ */
+static int journal_invocation_entry(sd_journal *j, const char *unit, struct invocation_table *t)
+{
+    const char *val = NULL;
+    const char *id = NULL;
+    size_t sz = 0;
+    uint64_t stamp;
+    bool manager = true;
+    journal_invocation *inv;
+
+    if (sd_journal_get_realtime_usec(j, &stamp) < 0)
+        return 0;
+
+    /* A manager logging about other units is not a message about this one */
+    if (journal_entry_is(j, "UNIT", unit))
+        id = journal_entry_id(j, "INVOCATION_ID");
+    else if (journal_entry_is(j, "USER_UNIT", unit))
+        id = journal_entry_id(j, "USER_INVOCATION_ID");
+    else if (journal_entry_is(j, "_SYSTEMD_UNIT", unit) || journal_entry_is(j, "_SYSTEMD_USER_UNIT", unit))
+    {
+        id = journal_entry_id(j, "_SYSTEMD_INVOCATION_ID");
+        manager = false;
+    }
+    if (!id)
+        return 0;
+
+    inv = invocation_table_get(t, id);
+    if (!inv)
+        return -ENOMEM;
+
+    if (!inv->start || stamp < inv->start)
+        inv->start = stamp;
+    if (stamp > inv->end)
+        inv->end = stamp;
+
+    if (!manager)
+    {
+        inv->lines++;
+        return 0;
+    }
+
+    if (sd_journal_get_data(j, "UNIT_RESULT", (const void **)&val, &sz) >= 0 && sz > 12)
+        snprintf(inv->result, sizeof(inv->result), "%.*s", (int)(sz - 12), val + 12);
+    else if (sd_journal_get_data(j, "MESSAGE_ID", (const void **)&val, &sz) >= 0 &&
+             sz == strlen(JOURNAL_UNIT_SUCCESS) && strncmp(val, JOURNAL_UNIT_SUCCESS, sz) == 0)
+        snprintf(inv->result, sizeof(inv->result), "success");
+    return 0;
+}
+
+static int compare_invocations(const void *a, const void *b)
+{
+    const journal_invocation *i1 = (const journal_invocation *)a;
+    const journal_invocation *i2 = (const journal_invocation *)b;
+
+    if (i1->start != i2->start)
+        return i1->start < i2->start ? 1 : -1;
+    return strcmp(i1->id, i2->id);
+}
+
+/**
+ * Lists the past runs of a unit found in the journal, newest first.
+ *
+ * The entries of the unit and the manager's messages about it are walked
+ * once, grouped by invocation ID into their start time, duration, line
+ * count and result.
+ *
+ * @param svc The unit to list the runs of.
+ * @param invocations Receives the array of runs.
+ * @param count Receives the number of runs.
+ * @return 0 on success, or a negative error code on failure.
+ */
+int journal_invocations(Service *svc, journal_invocation **invocations, size_t *count)
+{
+    sd_journal *j = NULL;
+    struct invocation_table table = {0};
+    journal_invocation *out = NULL;
+    size_t n = 0;
+    int rc;
+
+    *invocations = NULL;
+    *count = 0;
+
+    rc = sd_journal_open(&j, SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER);
+    if (rc < 0)
+        return rc;
+
+    /* Output of the unit itself */
+    journal_add_match_value(j, "_SYSTEMD_UNIT", svc->unit);
+    sd_journal_add_disjunction(j);
+    journal_add_match_value(j, "_SYSTEMD_USER_UNIT", svc->unit);
+    sd_journal_add_disjunction(j);
+
+    /* Messages of the system and user manager about the unit */
+    journal_add_match_value(j, "UNIT", svc->unit);
+    sd_journal_add_disjunction(j);
+    journal_add_match_value(j, "USER_UNIT", svc->unit);
+
+    SD_JOURNAL_FOREACH(j)
+    {
+        rc = journal_invocation_entry(j, svc->unit, &table);
+        if (rc < 0)
+            goto fin;
+    }
+
+    out = calloc(table.used ? table.used : 1, sizeof(journal_invocation));
+    if (!out)
+    {
+        rc = -ENOMEM;
+        goto fin;
+    }
+
+    for (size_t s = 0; s < table.size; s++)
+    {
+        journal_invocation *inv = &table.slots[s];
+
+        if (!inv->id[0])
+            continue;
+        if (!inv->result[0])
+            snprintf(inv->result, sizeof(inv->result), "%s",
+                     svc->detail && strcmp(inv->id, svc->detail->invocation_id) == 0 ? "running" : "-");
+        out[n++] = *inv;
+    }
+
+    qsort(out, n, sizeof(journal_invocation), compare_invocations);
+    *invocations = out;
+    *count = n;
+    out = NULL;
+    rc = 0;
+
+fin:
+    free(out);
+    free(table.slots);
+    sd_journal_close(j);
+    return rc;
+}
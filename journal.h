@@ -0,0 +1,40 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "bus.h"
+#include "snapshot.h"
+
+#define JOURNAL_MAX_WORKERS 8
+
+/* Aggregated journal volume of one unit in the current boot */
+typedef struct journal_talker
+{
+    char *unit;
+    uint64_t lines;
+    uint64_t bytes;
+} journal_talker;
+
+/* One run of a unit, as recorded in the journal */
+typedef struct journal_invocation
+{
+    char id[33];
+    uint64_t start;
+    uint64_t end;
+    uint64_t lines;
+    char result[32];
+} journal_invocation;
+
+typedef struct journal_scan journal_scan;
+
+journal_scan *journal_scan_start(void);
+bool journal_scan_done(journal_scan *scan);
+void journal_scan_progress(journal_scan *scan, int *done, int *total);
+void journal_scan_cancel(journal_scan *scan);
+int journal_scan_finish(journal_scan *scan, journal_talker **talkers, size_t *count);
+char *journal_format_talkers(const unit_snapshot *snap, journal_talker *talkers, size_t count);
+void journal_free_talkers(journal_talker *talkers, size_t count);
+int journal_invocations(Service *svc, journal_invocation **invocations, size_t *count);
+
+#endif
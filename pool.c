@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+/* Strings up to the largest class live in slabs, longer ones are malloced */
+static slab_pool string_pools[POOL_STRING_CLASSES] = {
+    {.name = "strings <= 16", .item_size = 16},
+    {.name = "strings <= 32", .item_size = 32},
+    {.name = "strings <= 64", .item_size = 64},
+    {.name = "strings <= 128", .item_size = 128},
+    {.name = "strings <= 256", .item_size = 256}};
+
+static uint64_t large_strings = 0;
+
+static int slab_grow(slab_pool *pool)
+{
+    void **slabs = NULL;
+    char *slab = NULL;
+
+    // Items must be able to hold the free list link
+    if (pool->item_size < sizeof(void *))
+        pool->item_size = sizeof(void *);
+
+    slabs = realloc(pool->slabs, (pool->slab_count + 1) * sizeof(void *));
+    if (!slabs)
+        return -1;
+    pool->slabs = slabs;
+
+    slab = malloc(pool->item_size * POOL_SLAB_ITEMS);
+    if (!slab)
+        return -1;
+    pool->slabs[pool->slab_count++] = slab;
+
+    // Thread the new items onto the free list, lowest address first
+    for (int i = POOL_SLAB_ITEMS - 1; i >= 0; i--)
+    {
+        void *item = slab + i * pool->item_size;
+
+        *(void **)item = pool->free_list;
+        pool->free_list = item;
+    }
+    return 0;
+}
+
+/**
+ * Takes a zeroed item from a pool, adding a slab if none is free.
+ *
+ * @param pool The pool to allocate from
+ * @return The item, or NULL if out of memory
+ */
+void *slab_alloc(slab_pool *pool)
+{
+    void *item = NULL;
+
+    if (!pool->free_list && slab_grow(pool) < 0)
+        return NULL;
+
+    item = pool->free_list;
+    pool->free_list = *(void **)item;
+    memset(item, 0, pool->item_size);
+
+    pool->in_use++;
+    pool->allocs++;
+    return item;
+}
+
+/**
+ * Returns an item to the free list of its pool.
+ *
+ * @param pool The pool the item was allocated from
+ * @param item The item, may be NULL
+ */
+void slab_free(slab_pool *pool, void *item)
+{
+    if (!item)
+        return;
+
+    *(void **)item = pool->free_list;
+    pool->free_list = item;
+
+    pool->in_use--;
+    pool->frees++;
+}
+
+void slab_stats(slab_pool *pool, pool_stats *stats)
+{
+    stats->name = pool->name;
+    stats->item_size = pool->item_size;
+    stats->slabs = pool->slab_count;
+    stats->capacity = pool->slab_count * POOL_SLAB_ITEMS;
+    stats->in_use = pool->in_use;
+    stats->allocs = pool->allocs;
+    stats->frees = pool->frees;
+}
+
+/* The size class holding a string of the given length, or -1 if none */
+static int pool_string_class(size_t len)
+{
+    for (int i = 0; i < POOL_STRING_CLASSES; i++)
+    {
+        if (len + 1 <= string_pools[i].item_size)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Copies a string into the string pool.
+ *
+ * Pooled strings must not be modified in length, as the size class they
+ * are returned to is derived from their length.
+ *
+ * @param str The string to copy
+ * @return The copy, or NULL if out of memory
+ */
+char *pool_strdup(const char *str)
+{
+    size_t len = strlen(str);
+    int size_class = pool_string_class(len);
+    char *copy = NULL;
+
+    if (size_class < 0)
+    {
+        large_strings++;
+        return strdup(str);
+    }
+
+    copy = slab_alloc(&string_pools[size_class]);
+    if (copy)
+        memcpy(copy, str, len + 1);
+    return copy;
+}
+
+/**
+ * Releases a string copied by pool_strdup().
+ *
+ * @param str The string, may be NULL
+ */
+void pool_strfree(char *str)
+{
+    int size_class;
+
+    if (!str)
+        return;
+
+    size_class = pool_string_class(strlen(str));
+    if (size_class < 0)
+    {
+        large_strings--;
+        free(str);
+        return;
+    }
+
+    slab_free(&string_pools[size_class], str);
+}
+
+/**
+ * Collects the counters of the string size classes.
+ *
+ * @param stats Receives the counters of each class
+ * @param max The number of entries stats can hold
+ * @param large Receives the number of strings too long for any class
+ * @return The number of entries written
+ */
+int pool_string_stats(pool_stats *stats, int max, uint64_t *large)
+{
+    int n = 0;
+
+    for (; n < POOL_STRING_CLASSES && n < max; n++)
+        slab_stats(&string_pools[n], &stats[n]);
+
+    *large = large_strings;
+    return n;
+}
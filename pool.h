@@ -0,0 +1,43 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_SLAB_ITEMS 256
+#define POOL_STRING_CLASSES 5
+
+/* Fixed size items carved from slabs of POOL_SLAB_ITEMS. Freed items go
+ * onto a free list and are handed out again before a new slab is made. */
+typedef struct slab_pool
+{
+    const char *name;
+    size_t item_size;
+    void **slabs;
+    size_t slab_count;
+    void *free_list;
+    size_t in_use;
+    uint64_t allocs;
+    uint64_t frees;
+} slab_pool;
+
+/* Allocation counters of one pool, for the statistics window */
+typedef struct pool_stats
+{
+    const char *name;
+    size_t item_size;
+    size_t slabs;
+    size_t capacity;
+    size_t in_use;
+    uint64_t allocs;
+    uint64_t frees;
+} pool_stats;
+
+void *slab_alloc(slab_pool *pool);
+void slab_free(slab_pool *pool, void *item);
+void slab_stats(slab_pool *pool, pool_stats *stats);
+
+char *pool_strdup(const char *str);
+void pool_strfree(char *str);
+int pool_string_stats(pool_stats *stats, int max, uint64_t *large);
+
+#endif
@@ -1,8 +1,12 @@
 #include "sm_err.h"
 #include "service.h"
 #include "display.h"
+#include "pool.h"
+#include "sort.h"
 #include <systemd/sd-journal.h>
 #include <stdlib.h> // For qsort
+#include <stddef.h>
+#include <ctype.h>
 
 const char *service_str_types[] = {
     "all",
@@ -20,24 +24,146 @@ const char *service_str_types[] = {
     "snapshot",
     "__unknown__"};
 
-/* Using the end of the units name, identify its service type */
-static void service_set_type(Service *svc)
+const char *service_str_states[] = {
+    "active",
+    "reloading",
+    "inactive",
+    "failed",
+    "activating",
+    "deactivating",
+    "maintenance",
+    "other"};
+
+/* Service records are carved from slabs, so records freed by a sweep are
+ * reused instead of fragmenting the heap */
+static slab_pool service_pool = {.name = "units", .item_size = sizeof(Service)};
+
+/* FNV-1a, for the atom and unit name tables */
+static uint32_t service_hash(const char *str)
 {
-    const char *dot = strrchr(svc->unit, '.');
-    if (!dot || dot == svc->unit)
-        return;
+    uint32_t hash = 2166136261u;
+
+    for (const char *p = str; *p; p++)
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    return hash;
+}
+
+/* The type of a unit by the suffix of its name */
+enum service_type service_type_of(const char *unit)
+{
+    const char *dot = strrchr(unit, '.');
+    if (!dot || dot == unit)
+        return ALL;
 
     for (int i = 0; i < MAX_TYPES; i++)
     {
         if (strcmp(dot + 1, service_str_types[i]) == 0)
-        {
-            svc->type = i;
-            return;
-        }
+            return i;
     }
 
-    svc->type = UNKNOWN;
-    return;
+    return UNKNOWN;
+}
+
+static char *service_lowercase(const char *str)
+{
+    char *out = NULL;
+
+    if (!str)
+        return NULL;
+
+    out = pool_strdup(str);
+    if (!out)
+        return NULL;
+
+    // Folding case keeps the length, as the string pool requires
+    for (char *p = out; *p; p++)
+        *p = tolower((unsigned char)*p);
+    return out;
+}
+
+static void service_set_search_keys(Service *svc)
+{
+    pool_strfree(svc->search_unit);
+    pool_strfree(svc->search_description);
+
+    svc->search_unit = service_lowercase(svc->unit);
+    svc->search_description = service_lowercase(svc->description);
+
+    svc->unit_key = sort_prefix(svc->unit);
+    svc->description_key = sort_prefix(svc->description);
+}
+
+/* Bytes of a detail block for a type, only its own union member counts */
+static size_t service_detail_size(enum service_type type)
+{
+    service_detail *d = NULL;
+    size_t base = offsetof(service_detail, u);
+
+    switch (type)
+    {
+    case SERVICE:
+        return base + sizeof(d->u.service);
+    case DEVICE:
+        return base + sizeof(d->u.device);
+    case MOUNT:
+        return base + sizeof(d->u.mount);
+    case TIMER:
+        return base + sizeof(d->u.timer);
+    case SOCKET:
+        return base + sizeof(d->u.socket);
+    default:
+        return base;
+    }
+}
+
+/**
+ * Returns the status details of a service, allocating them on first use.
+ *
+ * @param svc The service
+ * @return The details, or NULL if out of memory
+ */
+service_detail *service_detail_get(Service *svc)
+{
+    if (!svc->detail)
+        svc->detail = calloc(1, service_detail_size(svc->type));
+    return svc->detail;
+}
+
+/**
+ * Releases the status details of a service, they are allocated again the
+ * next time they are needed.
+ *
+ * @param svc The service
+ */
+void service_detail_free(Service *svc)
+{
+    service_detail *d = svc->detail;
+
+    if (!d)
+        return;
+
+    free(d->fragment_path);
+    switch (svc->type)
+    {
+    case SERVICE:
+        free(d->u.service.cgroup);
+        break;
+    case DEVICE:
+        free(d->u.device.sysfs_path);
+        break;
+    case MOUNT:
+        free(d->u.mount.where);
+        free(d->u.mount.what);
+        break;
+    case SOCKET:
+        free(d->u.socket.bind_ipv6_only);
+        break;
+    default:
+        break;
+    }
+
+    free(d);
+    svc->detail = NULL;
 }
 
 static void service_free(Service *svc)
@@ -45,67 +171,51 @@ static void service_free(Service *svc)
     if (!svc)
         return;
 
-    sd_bus_slot_unref(svc->slot);
-    free(svc->unit);
-    free(svc->load);
-    free(svc->active);
-    free(svc->sub);
-    free(svc->description);
-    free(svc->object);
-    free(svc->fragment_path);
-    free(svc->unit_file_state);
-    free(svc->cgroup);
-    free(svc->sysfs_path);
-    free(svc->mount_where);
-    free(svc->mount_what);
-    free(svc->bind_ipv6_only);
-    free(svc);
+    pool_strfree(svc->unit);
+    pool_strfree(svc->description);
+    pool_strfree(svc->search_unit);
+    pool_strfree(svc->search_description);
+    pool_strfree(svc->object);
+    free(svc->row);
+    service_detail_free(svc);
+    slab_free(&service_pool, svc);
 }
 
+struct logline
+{
+    char msg[2048];
+    char hostname[128];
+    char syslogident[128];
+    char pid[10];
+    uint64_t stamp;
+};
+
 /**
- * Retrieves the logs for a given service unit.
+ * Collects and formats the last log lines matched by an opened journal.
  *
- * @param svc The service unit to retrieve logs for.
+ * The caller sets up the matches on the journal, this function walks it
+ * backwards so the newest lines are kept, and formats them oldest first.
+ *
+ * @param j The journal with its matches already set up.
  * @param lines The maximum number of log lines to retrieve.
  * @return A dynamically allocated string containing the formatted logs, or NULL on failure.
  */
-char *service_logs(Service *svc, int lines)
+static char *service_logs_collect(sd_journal *j, int lines)
 {
-    sd_journal *j;
     char *out = NULL;
     char *ptr = NULL;
     int r;
-    char match[256] = {0};
     int total = 0;
     int left = lines;
-    struct logline
-    {
-        char msg[2048];
-        char hostname[128];
-        char syslogident[128];
-        char pid[10];
-        uint64_t stamp;
-    };
-
     struct logline *logs = NULL;
 
-    logs = alloca(sizeof(struct logline) * lines);
-    memset(logs, 0, sizeof(*logs) * lines);
-
-    r = sd_journal_open(&j, SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER);
-    if (r < 0)
+    logs = calloc(lines, sizeof(struct logline));
+    if (!logs)
     {
-        sm_err_set("Cannot retrieve journal: %s", strerror(-r));
+        sm_err_set("Cannot create logs: %s", strerror(errno));
         return NULL;
     }
 
-    snprintf(match, sizeof(match), "_SYSTEMD_INVOCATION_ID=%s", svc->invocation_id);
-    sd_journal_add_match(j, match, 0);
-
-    sd_journal_add_disjunction(j);
-    snprintf(match, sizeof(match), "USER_INVOCATION_ID=%s", svc->invocation_id);
-    sd_journal_add_match(j, match, 0);
-
     total = 0;
     SD_JOURNAL_FOREACH_BACKWARDS(j)
     {
@@ -189,10 +299,115 @@ char *service_logs(Service *svc, int lines)
     *ptr = '\0'; // Null termination
 
 fin:
+    free(logs);
+    return out;
+}
+
+/**
+ * Retrieves the logs of one invocation (run) of a service unit.
+ *
+ * @param invocation_id The 32 character invocation ID of the run.
+ * @param lines The maximum number of log lines to retrieve.
+ * @return A dynamically allocated string containing the formatted logs, or NULL on failure.
+ */
+char *service_logs_invocation(const char *invocation_id, int lines)
+{
+    sd_journal *j;
+    char *out = NULL;
+    int r;
+    char match[256] = {0};
+
+    r = sd_journal_open(&j, SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER);
+    if (r < 0)
+    {
+        sm_err_set("Cannot retrieve journal: %s", strerror(-r));
+        return NULL;
+    }
+
+    snprintf(match, sizeof(match), "_SYSTEMD_INVOCATION_ID=%s", invocation_id);
+    sd_journal_add_match(j, match, 0);
+
+    sd_journal_add_disjunction(j);
+    snprintf(match, sizeof(match), "USER_INVOCATION_ID=%s", invocation_id);
+    sd_journal_add_match(j, match, 0);
+
+    out = service_logs_collect(j, lines);
+
+    sd_journal_close(j);
+    return out;
+}
+
+/**
+ * Retrieves the logs of several units, interleaved by time.
+ *
+ * All units are matched in a single journal query, so the journal itself
+ * merges their entries in time order. Besides the output of the units,
+ * the messages of the system and user manager about them are included.
+ *
+ * @param svcs The units to retrieve logs for.
+ * @param count The number of units.
+ * @param lines The maximum number of log lines to retrieve.
+ * @return A dynamically allocated string containing the formatted logs, or NULL on failure.
+ */
+char *service_logs_units(Service **svcs, int count, int lines)
+{
+    /* Manager messages must come from the manager, as journalctl does, any
+     * process could log a UNIT= field. The user manager runs as the user. */
+    char user_manager[32];
+    const char *fields[][2] = {
+        {"_SYSTEMD_UNIT", NULL},
+        {"UNIT", "_PID=1"},
+        {"_SYSTEMD_USER_UNIT", NULL},
+        {"USER_UNIT", user_manager},
+    };
+    sd_journal *j;
+    char *out = NULL;
+    int r;
+    char match[512] = {0};
+
+    snprintf(user_manager, sizeof(user_manager), "_UID=%u", (unsigned)getuid());
+
+    r = sd_journal_open(&j, SD_JOURNAL_SYSTEM | SD_JOURNAL_CURRENT_USER);
+    if (r < 0)
+    {
+        sm_err_set("Cannot retrieve journal: %s", strerror(-r));
+        return NULL;
+    }
+
+    /* Matches on the same field are OR'ed, different fields are AND'ed
+     * and each group needs a disjunction */
+    for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+    {
+        if (f > 0)
+            sd_journal_add_disjunction(j);
+
+        for (int i = 0; i < count; i++)
+        {
+            snprintf(match, sizeof(match), "%s=%s", fields[f][0], svcs[i]->unit);
+            sd_journal_add_match(j, match, 0);
+        }
+        if (fields[f][1])
+            sd_journal_add_match(j, fields[f][1], 0);
+    }
+
+    out = service_logs_collect(j, lines);
+
     sd_journal_close(j);
     return out;
 }
 
+/**
+ * Retrieves the logs for a given service unit.
+ *
+ * @param svc The service unit to retrieve logs for.
+ * @param lines The maximum number of log lines to retrieve.
+ * @return A dynamically allocated string containing the formatted logs, or NULL on failure.
+ */
+char *service_logs(Service *svc, int lines)
+{
+    return service_logs_invocation(svc->detail ? svc->detail->invocation_id : "", lines);
+}
+
 /**
  * Formats the status of a service unit.
  *
@@ -205,49 +420,53 @@ static char *service_format_status(Service *svc)
     char *out = NULL;
     char *ptr = buf;
     time_t now = time(NULL);
+    service_detail *d = service_detail_get(svc);
+
+    if (!d)
+        return NULL;
 
     ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%30s - %s\n", svc->unit, svc->description);
-    ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s (%s)\n", "Loaded", svc->load, svc->fragment_path);
+    ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s (%s)\n", "Loaded", svc->load, d->fragment_path);
 
     switch (svc->type)
     {
     case SERVICE:
         if (strcmp(svc->active, "active") == 0 && strcmp(svc->sub, "running") == 0)
             ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s (%s) since %lu seconds ago\n",
-                            "Active", svc->active, svc->sub, now - (svc->exec_main_start / 1000000));
+                            "Active", svc->active, svc->sub, now - (d->u.service.exec_main_start / 1000000));
         else
             ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s (%s)\n",
                             "Active", svc->active, svc->sub);
 
         if (strcmp(svc->active, "active") == 0)
         {
-            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %u\n", "Main PID", svc->main_pid);
+            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %u\n", "Main PID", d->u.service.main_pid);
             ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %lu (limit: %lu)\n",
-                            "Tasks", svc->tasks_current, svc->tasks_max);
+                            "Tasks", d->u.service.tasks_current, d->u.service.tasks_max);
             ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %.1f (peak: %.1fM swap: %.1fM swap peak: %.1fM zswap: %.1fM))\n",
                             "Memory",
-                            (float)svc->memory_current / 1048576.0,
-                            (float)svc->memory_peak / 1048576.0,
-                            (float)svc->swap_current / 1048576.0,
-                            (float)svc->swap_peak / 1048576.0,
-                            (float)svc->zswap_current / 1048576.0);
-            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %lums\n", "CPU", svc->cpu_usage / 1000);
-            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "CGroup", svc->cgroup);
+                            (float)d->u.service.memory_current / 1048576.0,
+                            (float)d->u.service.memory_peak / 1048576.0,
+                            (float)d->u.service.swap_current / 1048576.0,
+                            (float)d->u.service.swap_peak / 1048576.0,
+                            (float)d->u.service.zswap_current / 1048576.0);
+            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %lums\n", "CPU", d->u.service.cpu_usage / 1000);
+            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "CGroup", d->u.service.cgroup);
         }
         break;
 
     case DEVICE:
-        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "SysFSPath", svc->sysfs_path);
+        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "SysFSPath", d->u.device.sysfs_path);
         break;
 
     case MOUNT:
-        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "Where", svc->mount_where);
-        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "What", svc->mount_what);
+        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "Where", d->u.mount.where);
+        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "What", d->u.mount.what);
         break;
 
     case TIMER:
     {
-        time_t next_elapse_sec = svc->next_elapse / 1000000;
+        time_t next_elapse_sec = d->u.timer.next_elapse / 1000000;
         struct tm *tm_info = localtime(&next_elapse_sec);
         char time_str[26];
         strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", tm_info);
@@ -281,13 +500,13 @@ static char *service_format_status(Service *svc)
     break;
 
     case SOCKET:
-        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "BindIPv6Only", svc->bind_ipv6_only);
-        if (svc->backlog == INT32_MAX || svc->backlog == UINT32_MAX)
+        ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %s\n", "BindIPv6Only", d->u.socket.bind_ipv6_only);
+        if (d->u.socket.backlog == INT32_MAX || d->u.socket.backlog == UINT32_MAX)
             ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: Unlimited\n", "Backlog");
-        else if (svc->backlog > INT16_MAX)
-            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: Invalid value (%u)\n", "Backlog", svc->backlog);
+        else if (d->u.socket.backlog > INT16_MAX)
+            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: Invalid value (%u)\n", "Backlog", d->u.socket.backlog);
         else
-            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %u\n", "Backlog", svc->backlog);
+            ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "%11s: %u\n", "Backlog", d->u.socket.backlog);
         break;
 
     case PATH:
@@ -314,10 +533,48 @@ static char *service_format_status(Service *svc)
     return out;
 }
 
+#define SERVICE_ATOMS 256
+
+/* Interned state strings. systemd only knows a few dozen load, active,
+ * sub and unit file states, so the table never fills up in practice. */
+static char *service_atoms[SERVICE_ATOMS];
+
+static int service_atom_count = 0;
+
+/**
+ * Interns a state string.
+ *
+ * Equal strings yield the same pointer, so units share one copy of each
+ * state and states can be compared by pointer. Atoms are never freed.
+ *
+ * @param str The string to intern
+ * @return The interned string, or NULL if out of memory or atoms
+ */
+const char *service_atom(const char *str)
+{
+    uint32_t hash;
+
+    if (!str)
+        return NULL;
+
+    hash = service_hash(str);
+    for (int i = 0; i < SERVICE_ATOMS; i++)
+    {
+        char **slot = &service_atoms[(hash + i) % SERVICE_ATOMS];
+
+        if (!*slot && (*slot = strdup(str)))
+            service_atom_count++;
+        if (!*slot || strcmp(*slot, str) == 0)
+            return *slot;
+    }
+
+    return NULL;
+}
+
 /**
  * Initializes a new Service struct and returns a pointer to it.
  *
- * This function allocates memory for a new Service struct and returns a pointer to it.
+ * This function takes a new Service struct from the service slab and returns a pointer to it.
  * The struct is initialized with all fields set to 0 or NULL.
  *
  * @return A pointer to the newly initialized Service struct.
@@ -327,18 +584,19 @@ Service *service_init(const char *name)
     Service *svc = NULL;
     char *nm = NULL;
 
-    svc = calloc(1, sizeof(Service));
-    nm = strdup(name);
+    svc = slab_alloc(&service_pool);
+    nm = pool_strdup(name);
 
     if (!svc || !nm)
     {
-        free(svc);
-        free(nm);
+        slab_free(&service_pool, svc);
+        pool_strfree(nm);
         return NULL;
     }
 
     svc->unit = nm;
-    service_set_type(svc);
+    svc->type = service_type_of(name);
+    service_set_search_keys(svc);
 
     return svc;
 }
@@ -362,32 +620,103 @@ Service *service_nth(Bus *bus, int n)
     }
     return NULL;
 }
-/**
- * Finds the service with the specified y-position in the service list.
- *
- * @param ypos The y-position of the service to find.
- * @return The service with the specified y-position, or NULL if not found.
- */
-Service *service_ypos(Bus *bus, int ypos)
+
+/* Double the buckets of the name table, at least one unit per bucket on
+ * average keeps the chains short */
+static int service_names_grow(Bus *bus)
 {
-    Service *svc;
+    uint32_t size = bus->names_size ? bus->names_size * 2 : 256;
+    Service **names = NULL;
 
-    TAILQ_FOREACH(svc, &bus->services, e)
+    names = calloc(size, sizeof(Service *));
+    if (!names)
+        return -1;
+
+    for (uint32_t i = 0; i < bus->names_size; i++)
     {
-        if (svc->ypos == ypos)
-            return svc;
+        Service *svc = bus->names[i];
+
+        while (svc)
+        {
+            Service *next = svc->name_next;
+            uint32_t b = service_hash(svc->unit) & (size - 1);
+
+            svc->name_next = names[b];
+            names[b] = svc;
+            svc = next;
+        }
     }
 
-    return NULL;
+    free(bus->names);
+    bus->names = names;
+    bus->names_size = size;
+    return 0;
+}
+
+static int service_names_add(Bus *bus, Service *svc)
+{
+    uint32_t b;
+
+    if (bus->names_count >= bus->names_size && service_names_grow(bus) < 0)
+        return -1;
+
+    b = service_hash(svc->unit) & (bus->names_size - 1);
+    svc->name_next = bus->names[b];
+    bus->names[b] = svc;
+    bus->names_count++;
+    return 0;
 }
 
-/* Insert service into the list in a sorted order */
+static void service_names_remove(Bus *bus, Service *svc)
+{
+    Service **link = NULL;
+
+    if (!bus->names_size)
+        return;
+
+    link = &bus->names[service_hash(svc->unit) & (bus->names_size - 1)];
+    for (; *link; link = &(*link)->name_next)
+    {
+        if (*link != svc)
+            continue;
+
+        *link = svc->name_next;
+        svc->name_next = NULL;
+        bus->names_count--;
+        return;
+    }
+}
+
+/**
+ * Inserts a unit into the list in sorted order and counts it.
+ *
+ * A stale record found again in a listing is taken back from the stale
+ * list. It is still in the name table and is only added to the search index
+ * again.
+ *
+ * @param bus The bus the unit was listed on
+ * @param svc The new or stale unit
+ */
 void service_insert(Bus *bus, Service *svc)
 {
     Service *node = NULL;
 
+    if (svc->stale)
+    {
+        TAILQ_REMOVE(&bus->stale, svc, e);
+        svc->stale = false;
+    }
+    else if (service_names_add(bus, svc) < 0)
+        sm_err_set("Cannot index unit %s by name", svc->unit);
+
+    svc->listed = true;
     bus->total_types[svc->type]++;
     bus->total_types[ALL]++;
+    bus->total_states[service_state_of(svc->active)]++;
+    bus->revision++;
+
+    if (trigram_add(&bus->trigrams, svc) < 0)
+        sm_err_set("Cannot index unit %s for searching", svc->unit);
 
     /* List is empty, add to the head of the list */
     if (TAILQ_EMPTY(&bus->services))
@@ -396,6 +725,14 @@ void service_insert(Bus *bus, Service *svc)
         return;
     }
 
+    /* Units often come in order, as from the unit cache */
+    node = TAILQ_LAST(&bus->services, service_list);
+    if (strcmp(node->object, svc->object) <= 0)
+    {
+        TAILQ_INSERT_TAIL(&bus->services, svc, e);
+        return;
+    }
+
     /* Find the next entry lexicographically above us and insert */
     TAILQ_FOREACH(node, &bus->services, e)
     {
@@ -410,12 +747,35 @@ void service_insert(Bus *bus, Service *svc)
     TAILQ_INSERT_TAIL(&bus->services, svc, e);
 }
 
-/* Return the service that matches this unit name */
+/* Take a unit off the list and out of the counters, onto the stale list */
+static void service_unlist(Bus *bus, Service *svc)
+{
+    TAILQ_REMOVE(&bus->services, svc, e);
+    trigram_remove(&bus->trigrams, svc);
+
+    bus->total_types[svc->type]--;
+    bus->total_types[ALL]--;
+    bus->total_states[service_state_of(svc->active)]--;
+    bus->revision++;
+
+    svc->listed = false;
+    svc->marked = false;
+    service_detail_free(svc);
+
+    TAILQ_INSERT_TAIL(&bus->stale, svc, e);
+    svc->stale = true;
+}
+
+/* Return the listed or stale service that matches this unit name */
 Service *service_get_name(Bus *bus, const char *name)
 {
     Service *svc = NULL;
 
-    TAILQ_FOREACH(svc, &bus->services, e)
+    if (!bus->names_size)
+        return NULL;
+
+    svc = bus->names[service_hash(name) & (bus->names_size - 1)];
+    for (; svc; svc = svc->name_next)
     {
         if (strcmp(name, svc->unit) == 0)
             return svc;
@@ -423,30 +783,43 @@ Service *service_get_name(Bus *bus, const char *name)
     return NULL;
 }
 
-/* Iterate through the list, remove any that haven't been updated since
- * timestamp */
-void services_prune_dead_units(Bus *bus, uint64_t ts)
+/**
+ * Sweeps the units that were not seen in the latest full listing.
+ *
+ * Every full listing bumps the generation of the bus and marks the units
+ * it returns with it. Units left with an older generation are taken off
+ * the list but kept as stale records, as systemd unloads idle units and
+ * loads them again on demand. Stale units leave the search index but stay
+ * in the name table, so one listed again gets its record and strings back.
+ * Records still stale at the next sweep are dropped from the name table
+ * and released.
+ *
+ * @param bus The bus that was just listed
+ */
+void services_sweep(Bus *bus)
 {
     int removed = 0;
     Service *svc = NULL;
 
+    while ((svc = TAILQ_FIRST(&bus->stale)))
+    {
+        TAILQ_REMOVE(&bus->stale, svc, e);
+        service_names_remove(bus, svc);
+        service_free(svc);
+    }
+
     svc = TAILQ_FIRST(&bus->services);
     while (svc)
     {
         Service *n;
         n = TAILQ_NEXT(svc, e);
 
-        if (svc->last_update >= ts)
+        if (svc->generation != bus->generation)
         {
-            svc = n;
-            continue;
+            if (display_unit_shown(svc))
+                removed++;
+            service_unlist(bus, svc);
         }
-
-        TAILQ_REMOVE(&bus->services, svc, e);
-        if (svc->ypos > -1)
-            removed++;
-
-        service_free(svc);
         svc = n;
     }
 
@@ -456,16 +829,43 @@ void services_prune_dead_units(Bus *bus, uint64_t ts)
     return;
 }
 
-/* This is used during the print services routine
- * to reset the y positions on all services, since not
- * every service is displayed at once. */
-void services_invalidate_ypos(Bus *bus)
+/* Return a newly allocated array of all marked services, in list order */
+Service **services_marked(Bus *bus, int *count)
+{
+    Service **marked = NULL;
+    Service *svc = NULL;
+    int n = 0;
+
+    TAILQ_FOREACH(svc, &bus->services, e)
+    {
+        Service **tmp;
+
+        if (!svc->marked)
+            continue;
+
+        tmp = realloc(marked, (n + 1) * sizeof(Service *));
+        if (!tmp)
+        {
+            free(marked);
+            *count = 0;
+            return NULL;
+        }
+        marked = tmp;
+        marked[n++] = svc;
+    }
+
+    *count = n;
+    return marked;
+}
+
+/* Clear the marks of all services */
+void services_unmark(Bus *bus)
 {
     Service *svc = NULL;
 
     TAILQ_FOREACH(svc, &bus->services, e)
     {
-        svc->ypos = -1;
+        svc->marked = false;
     }
 }
 
@@ -525,7 +925,7 @@ char *service_status_info(Bus *bus, Service *svc)
 
     out = service_format_status(svc);
     logs = service_logs(svc, 10);
-    if (!logs)
+    if (!out || !logs)
         goto fin;
 
     out = realloc(out, strlen(out) + strlen(logs) + 1);
@@ -550,53 +950,431 @@ const char *service_string_type(enum service_type type)
     return service_str_types[type];
 }
 
+const char *service_string_state(enum service_state state)
+{
+    return service_str_states[state];
+}
+
+/* Map an ActiveState to its counter, unknown states count as other */
+enum service_state service_state_of(const char *active)
+{
+    if (!active)
+        return STATE_OTHER;
+
+    for (int i = 0; i < STATE_OTHER; i++)
+    {
+        if (strcmp(active, service_str_states[i]) == 0)
+            return i;
+    }
+    return STATE_OTHER;
+}
+
 /**
- * Sorts the services in the bus using a custom comparison function.
+ * Sets the ActiveState of a unit, moving it between the state counters of
+ * the bus if it is listed.
  *
- * @param bus The bus containing the services to be sorted
- * @param compare_func The comparison function for sorting
+ * @param bus The bus the unit belongs to
+ * @param svc The unit
+ * @param active The new state, an atom
  */
-void service_sort(Bus *bus, int (*compare_func)(const void *, const void *))
+void service_set_active(Bus *bus, Service *svc, const char *active)
 {
-    // Count the number of services in the bus
-    int count = 0;
-    Service *svc;
-    TAILQ_FOREACH(svc, &bus->services, e)
+    if (svc->active == active)
+        return;
+
+    if (svc->listed)
     {
-        count++;
+        bus->total_states[service_state_of(svc->active)]--;
+        bus->total_states[service_state_of(active)]++;
+    }
+    svc->active = active;
+}
+
+/**
+ * Precomputes the lowercased search keys of a service.
+ *
+ * Must be called whenever the unit name or description changes, so the
+ * search never has to fold case while the user is typing. An indexed
+ * service is reindexed under its new keys.
+ *
+ * @param bus The bus the service belongs to
+ * @param svc The service to update the search keys of
+ */
+void service_update_search_keys(Bus *bus, Service *svc)
+{
+    bool indexed = svc->trigram_id != 0;
+
+    if (indexed)
+        trigram_remove(&bus->trigrams, svc);
+
+    service_set_search_keys(svc);
+
+    if (indexed && trigram_add(&bus->trigrams, svc) < 0)
+        sm_err_set("Cannot index unit %s for searching", svc->unit);
+}
+
+static bool service_search_boundary(const char *key, int i)
+{
+    return i == 0 || strchr(" -_.@:/", key[i - 1]) != NULL;
+}
+
+/**
+ * Scores how well a lowercased query matches a lowercased key.
+ *
+ * A literal substring always ranks above a scattered subsequence match,
+ * matches at the start of the key or of a word rank higher, and for
+ * subsequences consecutive characters are rewarded while gaps cost.
+ *
+ * @return The score, or -1 if the query is not a subsequence of the key,
+ * or with exact set, not a substring of it.
+ */
+static int service_fuzzy_score(const char *key, const char *query, int len, bool exact)
+{
+    const char *hit = NULL;
+    int score = 0, last = -1, k = 0;
+
+    if (!key)
+        return -1;
+
+    hit = strstr(key, query);
+    if (hit)
+    {
+        int pos = hit - key;
+
+        score = 3000 + len * 16 - (pos < 100 ? pos : 100);
+        if (service_search_boundary(key, pos))
+            score += 200;
+        if (pos == 0)
+            score += 200;
+        return score;
     }
 
-    if (count == 0)
+    if (exact)
+        return -1;
+
+    for (int i = 0; key[i] && k < len; i++)
     {
-        return; // No services to sort
+        if (key[i] != query[k])
+            continue;
+
+        score += 10;
+        if (last == i - 1)
+            score += 15;
+        if (service_search_boundary(key, i))
+            score += 20;
+        if (last >= 0)
+            score -= (i - last - 1) < 10 ? (i - last - 1) : 10;
+
+        last = i;
+        k++;
     }
 
-    // Create a temporary array with the services
-    Service **services_array = malloc(count * sizeof(Service *));
-    if (!services_array)
+    return k == len ? score : -1;
+}
+
+/* A query starting with a quote only matches literal substrings */
+static bool service_search_exact(const char *query)
+{
+    return query[0] == '\'';
+}
+
+/* Unit names rank above descriptions */
+static int service_search_score(Service *svc, const char *query, int len)
+{
+    bool exact = service_search_exact(query);
+    int unit, description;
+
+    if (exact)
     {
-        sm_err_set("Error allocating memory for sorting");
+        query++;
+        len--;
+        if (len == 0)
+            return 0;
+    }
+
+    unit = service_fuzzy_score(svc->search_unit, query, len, exact);
+    description = service_fuzzy_score(svc->search_description, query, len, exact);
+
+    if (unit >= 0)
+        unit += 500;
+    return unit > description ? unit : description;
+}
+
+static int compare_matches(const void *a, const void *b)
+{
+    const service_match *m1 = (const service_match *)a;
+    const service_match *m2 = (const service_match *)b;
+
+    if (m1->score != m2->score)
+        return m2->score - m1->score;
+    return m1->order - m2->order;
+}
+
+static void service_search_free_levels(service_search *search)
+{
+    for (int i = 0; i <= SERVICE_SEARCH_MAX; i++)
+    {
+        free(search->levels[i]);
+        search->levels[i] = NULL;
+        search->counts[i] = 0;
+    }
+}
+
+/* Match the current query against the services of the bus. Literal
+ * substrings of three characters or more are looked up in the trigram
+ * index, anything else has to visit every service. */
+static int service_search_scan(service_search *search)
+{
+    Service *svc = NULL;
+    Service **candidates = NULL;
+    service_match *matches = NULL;
+    int n = 0, order = 0, count = -EINVAL;
+
+    if (service_search_exact(search->query))
+        count = trigram_lookup(&search->bus->trigrams, search->query + 1, search->len - 1, &candidates);
+    if (count < 0 && count != -EINVAL)
+        return count;
+
+    matches = malloc((count >= 0 ? count + 1 : search->bus->total_types[ALL] + 1) * sizeof(service_match));
+    if (!matches)
+    {
+        free(candidates);
+        return -ENOMEM;
+    }
+
+    if (count >= 0)
+    {
+        // Candidates come in index order, which stands in for list order
+        for (int i = 0; i < count; i++)
+        {
+            int score = service_search_score(candidates[i], search->query, search->len);
+
+            if (score >= 0)
+                matches[n++] = (service_match){candidates[i], score, candidates[i]->trigram_id};
+        }
+        free(candidates);
+    }
+    else
+    {
+        TAILQ_FOREACH(svc, &search->bus->services, e)
+        {
+            int score = service_search_score(svc, search->query, search->len);
+
+            if (score >= 0)
+                matches[n++] = (service_match){svc, score, order};
+            order++;
+        }
+    }
+
+    qsort(matches, n, sizeof(service_match), compare_matches);
+
+    free(search->levels[search->len]);
+    search->levels[search->len] = matches;
+    search->counts[search->len] = n;
+    search->revision = search->bus->revision;
+    return n;
+}
+
+/* Services came or went since the matches were made, start over */
+static int service_search_revalidate(service_search *search)
+{
+    if (search->revision == search->bus->revision)
+        return 0;
+
+    service_search_free_levels(search);
+    if (search->len == 0)
+    {
+        search->revision = search->bus->revision;
+        return 0;
+    }
+    return service_search_scan(search);
+}
+
+/**
+ * Starts a new, empty incremental search over the services of a bus.
+ *
+ * @param bus The bus whose services are searched
+ * @param search The search state to initialize
+ */
+void service_search_start(Bus *bus, service_search *search)
+{
+    service_search_free_levels(search);
+    memset(search, 0, sizeof(*search));
+    search->bus = bus;
+    search->revision = bus->revision;
+}
+
+/**
+ * Appends a character to the query and narrows the matches.
+ *
+ * Any unit matching the longer query also matches the shorter one, so
+ * only the previous matches are rescored instead of all services. A literal
+ * query is looked up in the trigram index once its term has three
+ * characters.
+ *
+ * @param search The running search
+ * @param c The character typed
+ * @return The number of matches, or a negative error code
+ */
+int service_search_push(service_search *search, char c)
+{
+    service_match *prev = NULL;
+    service_match *matches = NULL;
+    int count = 0, n = 0;
+    int rc;
+
+    if (search->len >= SERVICE_SEARCH_MAX)
+        return search->counts[search->len];
+
+    rc = service_search_revalidate(search);
+    if (rc < 0)
+        return rc;
+
+    search->query[search->len++] = tolower((unsigned char)c);
+    search->query[search->len] = '\0';
+
+    prev = search->levels[search->len - 1];
+    count = search->counts[search->len - 1];
+    if (search->len == 1 || !prev)
+        return service_search_scan(search);
+
+    // A literal term just got long enough for the trigram index, whose
+    // candidates are usually far fewer than the previous matches
+    if (service_search_exact(search->query) && search->len - 1 == 3)
+        return service_search_scan(search);
+
+    matches = malloc((count + 1) * sizeof(service_match));
+    if (!matches)
+        return -ENOMEM;
+
+    for (int i = 0; i < count; i++)
+    {
+        int score = service_search_score(prev[i].svc, search->query, search->len);
+
+        if (score >= 0)
+            matches[n++] = (service_match){prev[i].svc, score, prev[i].order};
+    }
+
+    qsort(matches, n, sizeof(service_match), compare_matches);
+
+    free(search->levels[search->len]);
+    search->levels[search->len] = matches;
+    search->counts[search->len] = n;
+    return n;
+}
+
+/**
+ * Removes the last character of the query, restoring the previous matches.
+ *
+ * @param search The running search
+ */
+void service_search_pop(service_search *search)
+{
+    if (search->len == 0)
         return;
+
+    free(search->levels[search->len]);
+    search->levels[search->len] = NULL;
+    search->counts[search->len] = 0;
+    search->query[--search->len] = '\0';
+
+    if (search->len > 0 && !search->levels[search->len])
+        service_search_scan(search);
+}
+
+/**
+ * Returns the matches of the current query, best first.
+ *
+ * @param search The running search
+ * @param count Receives the number of matches
+ * @return The matches, or NULL if the query is empty
+ */
+service_match *service_search_results(service_search *search, int *count)
+{
+    *count = 0;
+    if (search->len == 0 || service_search_revalidate(search) < 0)
+        return NULL;
+
+    *count = search->counts[search->len];
+    return search->levels[search->len];
+}
+
+/**
+ * Ends a search and releases its matches.
+ *
+ * @param search The search to end
+ */
+void service_search_end(service_search *search)
+{
+    service_search_free_levels(search);
+    memset(search, 0, sizeof(*search));
+}
+
+static void service_statistics_pool(FILE *fp, pool_stats *st)
+{
+    fprintf(fp, "  %-16s %5zu %6zu %9zu %9zu %10lu %10lu\n",
+            st->name, st->item_size, st->slabs, st->capacity, st->in_use,
+            (unsigned long)st->allocs, (unsigned long)st->frees);
+}
+
+/**
+ * Formats the unit counts and allocation statistics for display.
+ *
+ * @param bus The bus whose units are counted
+ * @return A dynamically allocated string, or NULL on failure
+ */
+char *service_statistics(Bus *bus)
+{
+    pool_stats stats[POOL_STRING_CLASSES];
+    pool_stats units;
+    Service *svc = NULL;
+    uint64_t large = 0;
+    size_t sz = 0, reserved = 0, count = 0, details = 0, stale = 0;
+    char *out = NULL;
+    FILE *fp = NULL;
+    int n;
+
+    fp = open_memstream(&out, &sz);
+    if (!fp)
+        return NULL;
+
+    TAILQ_FOREACH(svc, &bus->services, e)
+    {
+        count++;
+        if (svc->detail)
+            details++;
     }
 
-    // Fill the array with services
-    int i = 0;
-    while (!TAILQ_EMPTY(&bus->services))
+    TAILQ_FOREACH(svc, &bus->stale, e)
     {
-        svc = TAILQ_FIRST(&bus->services);
-        TAILQ_REMOVE(&bus->services, svc, e);
-        services_array[i++] = svc;
+        stale++;
     }
 
-    // Sort the array with the provided comparison function
-    qsort(services_array, count, sizeof(Service *), compare_func);
+    fprintf(fp, "Units listed: %zu, with status details: %zu, state atoms: %d\n",
+            count, details, service_atom_count);
+    fprintf(fp, "Stale records: %zu, listing generation: %u\n", stale, bus->generation);
+
+    for (int i = 0; i < MAX_STATES; i++)
+        fprintf(fp, "%s%s: %d", i ? ", " : "Units ", service_string_state(i), bus->total_states[i]);
+    fprintf(fp, "\n\n");
+
+    fprintf(fp, "  %-16s %5s %6s %9s %9s %10s %10s\n",
+            "Pool", "Size", "Slabs", "Capacity", "In use", "Allocs", "Frees");
 
-    // Add the sorted services back to the list
-    for (i = 0; i < count; i++)
+    slab_stats(&service_pool, &units);
+    service_statistics_pool(fp, &units);
+    reserved += units.capacity * units.item_size;
+
+    n = pool_string_stats(stats, POOL_STRING_CLASSES, &large);
+    for (int i = 0; i < n; i++)
     {
-        TAILQ_INSERT_TAIL(&bus->services, services_array[i], e);
+        service_statistics_pool(fp, &stats[i]);
+        reserved += stats[i].capacity * stats[i].item_size;
     }
 
-    // Free the temporary array
-    free(services_array);
+    fprintf(fp, "\nLonger strings (malloc): %lu\n", (unsigned long)large);
+    fprintf(fp, "Slab memory reserved: %zu KiB\n", reserved / 1024);
+
+    fclose(fp);
+    return out;
 }
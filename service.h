@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/queue.h>
 #include <systemd/sd-bus.h>
 
@@ -40,70 +41,158 @@ enum service_type
     MAX_TYPES
 };
 
-typedef struct Service
+/* ActiveState of a unit, for the per-state counters of a bus */
+enum service_state
 {
-    int ypos;
-    int changed;
-    uint64_t last_update;
+    STATE_ACTIVE,
+    STATE_RELOADING,
+    STATE_INACTIVE,
+    STATE_FAILED,
+    STATE_ACTIVATING,
+    STATE_DEACTIVATING,
+    STATE_MAINTENANCE,
+    STATE_OTHER,
+    MAX_STATES
+};
 
-    char *unit;
-    char *load;
-    char *active;
-    char *sub;
-    char *description;
-    char *object;
+/* Status details of a unit, only allocated once its status is fetched.
+ * Just the union member of the unit's own type is allocated. */
+typedef struct service_detail
+{
     char *fragment_path;
-    char *unit_file_state;
     char invocation_id[33];
 
-    uint64_t exec_main_start;
-    uint32_t main_pid;
-    uint64_t tasks_current;
-    uint64_t tasks_max;
-    uint64_t memory_current;
-    uint64_t memory_peak;
-    uint64_t swap_current;
-    uint64_t swap_peak;
-    uint64_t zswap_current;
-    uint64_t zswap_peak;
-    uint64_t cpu_usage;
-
-    char *cgroup;
-    char *sysfs_path;     // For DEVICE
-    char *mount_where;    // For MOUNT
-    char *mount_what;     // For MOUNT
-    uint64_t next_elapse; // For TIMER
-    uint32_t backlog;     // For SOCKET
-    char *bind_ipv6_only; // For SOCKET
+    union
+    {
+        struct
+        {
+            uint64_t exec_main_start;
+            uint32_t main_pid;
+            uint64_t tasks_current;
+            uint64_t tasks_max;
+            uint64_t memory_current;
+            uint64_t memory_peak;
+            uint64_t swap_current;
+            uint64_t swap_peak;
+            uint64_t zswap_current;
+            uint64_t zswap_peak;
+            uint64_t cpu_usage;
+            char *cgroup;
+        } service;
 
-    enum service_type type;
-    sd_bus_slot *slot;
+        struct
+        {
+            char *sysfs_path;
+        } device;
+
+        struct
+        {
+            char *where;
+            char *what;
+        } mount;
+
+        struct
+        {
+            uint64_t next_elapse;
+        } timer;
 
+        struct
+        {
+            uint32_t backlog;
+            char *bind_ipv6_only;
+        } socket;
+    } u;
+} service_detail;
+
+/* A unit as listed. Everything needed to draw, sort, search and filter
+ * the list comes first, the states are atoms from service_atom() so they
+ * are shared between units and compare by pointer. */
+typedef struct Service
+{
     TAILQ_ENTRY(Service)
     e;
+
+    char *unit;
+    char *description;
+    const char *load;
+    const char *active;
+    const char *sub;
+    const char *unit_file_state;
+    enum service_type type;
+    int view_pos; // Index in the displayed list, valid only if the list holds the unit there
+    int changed;
+    bool marked;
+    bool listed; // In the services list and counted
+    bool stale;  // Missing from the last listing, kept for reuse
+    bool cached; // Read from the unit cache and not listed yet
+    bool filter_match;
+    uint32_t filter_generation; // Filter that filter_match was computed for, 0 if stale
+    uint32_t trigram_id;        // Id in the bus trigram index, 0 if not indexed
+    uint32_t snapshot_pos;      // Position in the bus snapshot plus one, 0 if not in it
+    char *search_unit;          // Lowercased unit, for searching
+    char *search_description;   // Lowercased description, for searching
+    uint64_t unit_key;          // Natural order prefix of the unit, for sorting
+    uint64_t description_key;   // Natural order prefix of the description
+    uint32_t generation;        // Listing of the bus the unit was last seen in
+    char *row;                  // Composed text of the unit's row on screen
+    uint32_t row_layout;        // Column layout row was composed for, 0 if stale
+
+    char *object;
+    struct Service *name_next; // Next unit in the same bucket of the bus name table
+    service_detail *detail; // NULL until the status is fetched
 } Service;
 
 TAILQ_HEAD(service_list, Service);
 
+#define SERVICE_SEARCH_MAX 50
+
+typedef struct service_match
+{
+    Service *svc;
+    int score;
+    int order;
+} service_match;
+
+/* An incremental search, levels[n] holds the matches of the first n
+ * characters of the query */
+typedef struct service_search
+{
+    struct bus_state *bus;
+    unsigned long revision;
+    char query[SERVICE_SEARCH_MAX + 1];
+    int len;
+    service_match *levels[SERVICE_SEARCH_MAX + 1];
+    int counts[SERVICE_SEARCH_MAX + 1];
+} service_search;
+
 #include "bus.h"
 Service *service_get_name(Bus *bus, const char *name);
 Service *service_init(const char *name);
+const char *service_atom(const char *str);
+service_detail *service_detail_get(Service *svc);
+void service_detail_free(Service *svc);
 Service *service_next(Service *svc);
 Service *service_nth(Bus *bus, int n);
-Service *service_ypos(Bus *bus, int ypos);
+char *service_logs(Service *svc, int lines);
+char *service_logs_invocation(const char *invocation_id, int lines);
+char *service_logs_units(Service **svcs, int count, int lines);
 char *service_status_info(Bus *bus, Service *svc);
+char *service_statistics(Bus *bus);
 const char *service_string_type(enum service_type type);
+const char *service_string_state(enum service_state state);
+enum service_state service_state_of(const char *active);
+enum service_type service_type_of(const char *unit);
+void service_set_active(Bus *bus, Service *svc, const char *active);
 uint64_t service_now(void);
 void service_insert(Bus *bus, Service *svc);
-void services_invalidate_ypos(Bus *bus);
-void services_prune_dead_units(Bus *bus, uint64_t ts);
-
-/**
- * Sortiert die Services im Bus anhand einer benutzerdefinierten Vergleichsfunktion.
- *
- * @param bus Der Bus mit den zu sortierenden Services
- * @param compare_func Die Vergleichsfunktion für die Sortierung
- */
-void service_sort(Bus *bus, int (*compare_func)(const void *, const void *));
+Service **services_marked(Bus *bus, int *count);
+void services_unmark(Bus *bus);
+void services_sweep(Bus *bus);
+void service_update_search_keys(Bus *bus, Service *svc);
+void service_search_start(Bus *bus, service_search *search);
+int service_search_push(service_search *search, char c);
+void service_search_pop(service_search *search);
+service_match *service_search_results(service_search *search, int *count);
+void service_search_end(service_search *search);
 
 #endif
@@ -1,9 +1,13 @@
 #include "sm_err.h"
 #include "display.h"
 #include "bus.h"
+#include "dump.h"
+#include "ingest.h"
 #include "lib/toml.h"
 #include <ncurses.h>
 #include <getopt.h>
+#include <signal.h>
+#include <strings.h>
 
 #define CONFIG_FILE "/etc/servicemaster/servicemaster.toml"
 
@@ -27,7 +31,11 @@ const char *help = "\nUsage: servicemaster [options]\n\n"
                    "      Names with a space must be enclosed in quotes!\n"
                    "  -l  List all available colorschemes\n"
                    "  -p  Print configuration file (with colorschemes)\n"
-                   "  -e  Edit the configuration file\n\n"
+                   "  -e  Edit the configuration file\n"
+                   "  --dump  Write the units to stdout once and exit, without the interface\n"
+                   "      --format=json|ndjson|csv  Output format (default json)\n"
+                   "      --bus=system|user  Bus to list (default system)\n"
+                   "      --filter=EXPR  Only units matching a filter expression as for F\n\n"
                    "After launching ServiceMaster, you can use the following controls:\n"
                    "- Arrow keys (hljk), page up/down: Navigate through the list of units.\n"
                    "- Space: Toggle between system and user units.\n"
@@ -36,8 +44,14 @@ const char *help = "\nUsage: servicemaster [options]\n\n"
                    "- a-z: Quick filter units by type.\n"
                    "- q or ESC: Quit the application.\n"
                    "- +,-: Switch between colorschemes.\n"
-                   "- f: Search for units by name.\n"
-                   "- Tab: Select column to sort, Return: Sort.\n\n"
+                   "- f: Search units by name and description, the list narrows as you type. Start with ' to match a literal substring only.\n"
+                   "- Tab: Select column to sort, Return: Sort, Space: Sort by it next.\n"
+                   "- J: Show the units writing most to the journal this boot.\n"
+                   "- I: Show past runs of the selected unit, Return: Show its logs.\n"
+                   "- x: Mark/unmark unit, X: Unmark all, L: Show merged logs of marked units.\n"
+                   "- F: Filter units by expression, e.g. type=service active=failed name~^nginx desc~cache.\n"
+                   "- S: Show unit counts and memory statistics.\n"
+                   "- Mouse: Click selects a unit, click on a header sorts, wheel scrolls.\n\n"
                    "                2025 Lennart Martens\n\n"
                    "Configuration and colorschemes are stored in:\n" CONFIG_FILE "\n\n"
                    "License: MIT Version: " D_VERSION "\n"
@@ -107,11 +121,31 @@ void wait_input()
     return;
 }
 
+// Long only options, numbered past any short option character
+enum long_option
+{
+    OPT_DUMP = 256,
+    OPT_FORMAT,
+    OPT_BUS,
+    OPT_FILTER
+};
+
+static const struct option long_options[] = {
+    {"dump", no_argument, NULL, OPT_DUMP},
+    {"format", required_argument, NULL, OPT_FORMAT},
+    {"bus", required_argument, NULL, OPT_BUS},
+    {"filter", required_argument, NULL, OPT_FILTER},
+    {NULL, 0, NULL, 0}};
+
 int main(int argc, char *argv[])
 {
     setup_signal_handlers();
     program_name = argv[0];
     int option;
+    bool dump = false;
+    int dump_format = DUMP_JSON;
+    enum bus_type dump_bus = SYSTEM;
+    const char *dump_filter = NULL;
     scheme_count = 0;
     colorscheme = 0;
     color_schemes = NULL;
@@ -119,7 +153,8 @@ int main(int argc, char *argv[])
 
     // Parse command line options using getopt
     // v: version, w: no welcome, h: help, c: colorscheme, l: list schemes, p: print config, e: edit config
-    while ((option = getopt(argc, argv, "vwhc:lpe")) != -1)
+    // Long options: --dump [--format=json|ndjson|csv] [--bus=system|user] [--filter=EXPR]
+    while ((option = getopt_long(argc, argv, "vwhc:lpe", long_options, NULL)) != -1)
     {
         switch (option)
         {
@@ -188,12 +223,54 @@ int main(int argc, char *argv[])
             }
             return EXIT_SUCCESS;
 
+        case OPT_DUMP:
+            dump = true;
+            break;
+
+        case OPT_FORMAT:
+            dump_format = dump_format_of(optarg);
+            if (dump_format < 0)
+            {
+                fprintf(stderr, "Unknown format '%s': Use json, ndjson or csv\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case OPT_BUS:
+            if (strcasecmp(optarg, "system") == 0)
+                dump_bus = SYSTEM;
+            else if (strcasecmp(optarg, "user") == 0)
+                dump_bus = USER;
+            else
+            {
+                fprintf(stderr, "Unknown bus '%s': Use system or user\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case OPT_FILTER:
+            dump_filter = optarg;
+            break;
+
         default:
             printf("Wrong arguments: Type -h for help\n");
             return EXIT_FAILURE;
         }
     }
 
+    // Headless export, needs neither colorschemes nor a terminal
+    if (dump)
+    {
+        // Stop quietly when the reader goes away, e.g. piped into head
+        signal(SIGPIPE, SIG_DFL);
+        if (!load_unit_settings(CONFIG_FILE))
+        {
+            sm_err_set("Failed to load unit settings\n");
+            return EXIT_FAILURE;
+        }
+        return dump_units(dump_bus, dump_format, dump_filter);
+    }
+
     // Load default colorscheme if none specified via command line
     if (load_actual)
     {
@@ -218,6 +295,13 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Which units to track, must be known before the first unit is read
+    if (!load_unit_settings(CONFIG_FILE))
+    {
+        sm_err_set("Failed to load unit settings\n");
+        return EXIT_FAILURE;
+    }
+
     // Set bus type to USER for regular users, SYSTEM for root
     if (geteuid())
         display_set_bus_type(USER);
@@ -235,6 +319,9 @@ int main(int argc, char *argv[])
     // Enter main input loop
     wait_input();
 
+    // The ingestion thread reads the exclude patterns freed below
+    ingest_stop();
+
     // Cleanup and restore terminal state
     reset_terminal_title();
     endwin();
@@ -243,5 +330,6 @@ int main(int argc, char *argv[])
 
     // Free allocated color schemes
     free_color_schemes();
+    free_exclude_patterns();
     return EXIT_SUCCESS;
 }
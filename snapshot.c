@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include "sm_err.h"
+#include "snapshot.h"
+
+struct snapshot_chunk
+{
+    int refs;
+    int count;
+    char *strings; // Names and descriptions of the units, back to back
+    snapshot_unit units[SNAPSHOT_CHUNK];
+};
+
+/* Open addressing table of unit indexes plus one, shared by all snapshots
+ * of the same bus revision as they hold the same units */
+struct snapshot_names
+{
+    int refs;
+    uint32_t size;
+    uint32_t slots[];
+};
+
+/* FNV-1a, good enough for unit names */
+static uint32_t snapshot_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void snapshot_chunk_release(snapshot_chunk *chunk)
+{
+    if (!chunk || __atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    free(chunk->strings);
+    free(chunk);
+}
+
+/**
+ * Copies up to SNAPSHOT_CHUNK units into a new chunk.
+ *
+ * @param svc The first unit to copy.
+ * @param pos The position of svc in the list.
+ * @param next Receives the unit following the last one copied.
+ * @return The chunk, or NULL if out of memory.
+ */
+static snapshot_chunk *snapshot_chunk_build(Service *svc, uint32_t pos, Service **next)
+{
+    snapshot_chunk *chunk = calloc(1, sizeof(snapshot_chunk));
+    Service *s = svc;
+    size_t size = 0;
+    char *p;
+
+    if (!chunk)
+        return NULL;
+
+    for (int i = 0; s && i < SNAPSHOT_CHUNK; i++, s = TAILQ_NEXT(s, e))
+        size += strlen(s->unit) + 1 + (s->description ? strlen(s->description) : 0) + 1;
+
+    chunk->strings = malloc(size);
+    if (!chunk->strings)
+    {
+        free(chunk);
+        return NULL;
+    }
+
+    p = chunk->strings;
+    for (s = svc; s && chunk->count < SNAPSHOT_CHUNK; s = TAILQ_NEXT(s, e))
+    {
+        snapshot_unit *u = &chunk->units[chunk->count++];
+        const char *description = s->description ? s->description : "";
+
+        u->unit = strcpy(p, s->unit);
+        p += strlen(p) + 1;
+        u->description = strcpy(p, description);
+        p += strlen(p) + 1;
+        u->load = s->load;
+        u->active = s->active;
+        u->sub = s->sub;
+        u->unit_file_state = s->unit_file_state;
+        u->type = s->type;
+        s->snapshot_pos = pos + chunk->count; // Plus one, count is past the unit
+    }
+
+    chunk->refs = 1;
+    *next = s;
+    return chunk;
+}
+
+static snapshot_names *snapshot_names_build(unit_snapshot *snap)
+{
+    uint32_t size = 16;
+    snapshot_names *names;
+
+    while (size < snap->count * 2)
+        size *= 2;
+
+    names = calloc(1, sizeof(snapshot_names) + size * sizeof(uint32_t));
+    if (!names)
+        return NULL;
+
+    names->refs = 1;
+    names->size = size;
+    for (uint32_t i = 0; i < snap->count; i++)
+    {
+        uint32_t pos = snapshot_hash(snapshot_get(snap, i)->unit) & (size - 1);
+
+        while (names->slots[pos])
+            pos = (pos + 1) & (size - 1);
+        names->slots[pos] = i + 1;
+    }
+
+    return names;
+}
+
+/**
+ * Copies the units of a bus into a new snapshot.
+ *
+ * Chunks of the previous snapshot not marked dirty by snapshot_touch() are
+ * shared instead of copied, as long as no unit was added or removed.
+ *
+ * @param bus The bus to copy the units of.
+ * @param prev The previous snapshot of the bus, NULL to copy everything.
+ * @return The snapshot, or NULL if out of memory.
+ */
+static unit_snapshot *snapshot_build(Bus *bus, unit_snapshot *prev)
+{
+    uint32_t count = bus->total_types[ALL];
+    uint32_t nchunks = (count + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+    unit_snapshot *snap = NULL;
+    Service *svc = TAILQ_FIRST(&bus->services);
+
+    if (prev && (prev->revision != bus->revision || prev->count != count))
+        prev = NULL;
+
+    snap = calloc(1, sizeof(unit_snapshot) + nchunks * sizeof(snapshot_chunk *));
+    if (!snap)
+        return NULL;
+
+    snap->refs = 1;
+    snap->bus = bus->type;
+    snap->revision = bus->revision;
+    snap->count = count;
+    snap->nchunks = nchunks;
+    snap->dirty = calloc(nchunks ? nchunks : 1, sizeof(bool));
+    if (!snap->dirty)
+        goto fail;
+
+    for (uint32_t c = 0; c < nchunks && svc; c++)
+    {
+        Service *next = NULL;
+
+        if (prev && !prev->dirty[c])
+        {
+            snap->chunks[c] = prev->chunks[c];
+            __atomic_add_fetch(&snap->chunks[c]->refs, 1, __ATOMIC_RELAXED);
+            for (int i = 0; i < SNAPSHOT_CHUNK && svc; i++)
+                svc = TAILQ_NEXT(svc, e);
+            continue;
+        }
+
+        snap->chunks[c] = snapshot_chunk_build(svc, c * SNAPSHOT_CHUNK, &next);
+        if (!snap->chunks[c])
+            goto fail;
+        svc = next;
+    }
+
+    if (prev)
+    {
+        snap->names = prev->names;
+        __atomic_add_fetch(&snap->names->refs, 1, __ATOMIC_RELAXED);
+    }
+    else
+        snap->names = snapshot_names_build(snap);
+    if (!snap->names)
+        goto fail;
+
+    return snap;
+
+fail:
+    snapshot_release(snap);
+    return NULL;
+}
+
+/**
+ * Marks the chunk holding a unit as changed, so the next snapshot copies
+ * it again.
+ *
+ * Must be called on the UI thread whenever a field of a listed unit that
+ * snapshots hold changes. Units added, removed or moved bump the bus
+ * revision instead.
+ *
+ * @param bus The bus the unit belongs to.
+ * @param svc The unit whose fields changed.
+ */
+void snapshot_touch(Bus *bus, Service *svc)
+{
+    unit_snapshot *snap = bus->snapshot;
+    uint32_t c;
+
+    // Positions of another revision may be off, a whole new copy is due then
+    if (!snap || snap->revision != bus->revision || !svc->snapshot_pos || svc->snapshot_pos > snap->count)
+        return;
+
+    c = (svc->snapshot_pos - 1) / SNAPSHOT_CHUNK;
+    if (!snap->dirty[c])
+    {
+        snap->dirty[c] = true;
+        snap->ndirty++;
+    }
+}
+
+/**
+ * Takes a reference to a snapshot of the current units of a bus.
+ *
+ * Must be called on the UI thread, which changes the units. The snapshot
+ * is only taken when the units changed since the last one, copying the
+ * chunks marked dirty. It never changes and stays valid until released,
+ * however the bus changes meanwhile, so it may be handed to other threads.
+ *
+ * @param bus The bus to read the units of.
+ * @return The snapshot.
+ */
+unit_snapshot *snapshot_acquire(Bus *bus)
+{
+    unit_snapshot *prev = bus->snapshot;
+    unit_snapshot *snap = prev;
+
+    if (!prev || prev->revision != bus->revision || prev->ndirty)
+    {
+        snap = snapshot_build(bus, prev);
+        if (!snap)
+            sm_err_set("Cannot copy the unit list: %s", strerror(errno));
+
+        bus->snapshot = snap;
+        snapshot_release(prev);
+    }
+
+    __atomic_add_fetch(&snap->refs, 1, __ATOMIC_RELAXED);
+
+    return snap;
+}
+
+/* Drops a reference taken with snapshot_acquire(), NULL is ignored */
+void snapshot_release(unit_snapshot *snap)
+{
+    if (!snap || __atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    for (uint32_t c = 0; c < snap->nchunks; c++)
+        snapshot_chunk_release(snap->chunks[c]);
+
+    if (snap->names && __atomic_sub_fetch(&snap->names->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(snap->names);
+    free(snap->dirty);
+    free(snap);
+}
+
+/* The unit at position i of the list, i must be below snap->count */
+const snapshot_unit *snapshot_get(const unit_snapshot *snap, uint32_t i)
+{
+    return &snap->chunks[i / SNAPSHOT_CHUNK]->units[i % SNAPSHOT_CHUNK];
+}
+
+/* Looks a unit up by name, NULL if it is not in the snapshot */
+const snapshot_unit *snapshot_find(const unit_snapshot *snap, const char *unit)
+{
+    const snapshot_names *names = snap ? snap->names : NULL;
+    uint32_t pos;
+
+    if (!names)
+        return NULL;
+
+    pos = snapshot_hash(unit) & (names->size - 1);
+    while (names->slots[pos])
+    {
+        const snapshot_unit *u = snapshot_get(snap, names->slots[pos] - 1);
+
+        if (strcmp(u->unit, unit) == 0)
+            return u;
+        pos = (pos + 1) & (names->size - 1);
+    }
+
+    return NULL;
+}
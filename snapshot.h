@@ -0,0 +1,46 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include "bus.h"
+
+/* Units per chunk, chunks are shared by snapshots while their units do not change */
+#define SNAPSHOT_CHUNK 256
+
+/* A unit as it was when the snapshot was taken. The states are atoms, the
+ * strings belong to the chunk. */
+typedef struct snapshot_unit
+{
+    const char *unit;
+    const char *description;
+    const char *load;
+    const char *active;
+    const char *sub;
+    const char *unit_file_state;
+    enum service_type type;
+} snapshot_unit;
+
+typedef struct snapshot_chunk snapshot_chunk;
+typedef struct snapshot_names snapshot_names;
+
+/* An immutable copy of the units of a bus in list order. Readers hold it
+ * with snapshot_acquire() until snapshot_release(), on any thread. */
+typedef struct unit_snapshot
+{
+    int refs;
+    enum bus_type bus;
+    unsigned long revision; // Bus revision the snapshot was taken at
+    uint32_t count;
+    uint32_t nchunks;
+    uint32_t ndirty; // Chunks whose units changed since, kept by the UI thread
+    bool *dirty;     // A flag per chunk, kept by the UI thread
+    snapshot_names *names;
+    snapshot_chunk *chunks[];
+} unit_snapshot;
+
+void snapshot_touch(Bus *bus, Service *svc);
+unit_snapshot *snapshot_acquire(Bus *bus);
+void snapshot_release(unit_snapshot *snap);
+const snapshot_unit *snapshot_get(const unit_snapshot *snap, uint32_t i);
+const snapshot_unit *snapshot_find(const unit_snapshot *snap, const char *unit);
+#endif
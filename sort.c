@@ -0,0 +1,560 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sort.h"
+
+/* Ranks 0 for no state, 1.. for the known states, then unknown states */
+#define SORT_RANKS 16
+
+#define SORT_IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+// Sort order for STATE values
+static const char *state_order[] = {
+    "enabled",
+    "enabled-runtime",
+    "loaded",
+    "generated",
+    "transient",
+    "static",
+    "not-found",
+    "disabled",
+    "masked",
+    NULL // End marker
+};
+
+// Sort order for ACTIVE values
+static const char *active_order[] = {
+    "active",
+    "reloading",
+    "activating",
+    "deactivating",
+    "inactive",
+    "failed",
+    "maintenance",
+    NULL // End marker
+};
+
+// Sort order for SUB values
+static const char *sub_order[] = {
+    "exited",
+    "running",
+    "mounted",
+    "active",
+    "dead",
+    "waiting",
+    "plugged",
+    "listening",
+    "failed",
+    NULL // End marker
+};
+
+static const char **sort_orders[MAX_SORT_FIELDS] = {
+    [SORT_BY_STATE] = state_order,
+    [SORT_BY_ACTIVE] = active_order,
+    [SORT_BY_SUB] = sub_order};
+
+/* The orders as atoms, so ranking a unit compares pointers only */
+static const char *sort_order_atoms[MAX_SORT_FIELDS][SORT_RANKS];
+static bool sort_atoms_ready = false;
+
+/* A unit being sorted, with its composite key and the chunk of it sorted
+ * on at present */
+typedef struct sort_item
+{
+    uint64_t chunk;
+    const unsigned char *key;
+    size_t len;
+    Service *svc;
+} sort_item;
+
+static void sort_init_atoms(void)
+{
+    for (int f = 0; f < MAX_SORT_FIELDS; f++)
+    {
+        if (!sort_orders[f])
+            continue;
+
+        for (int i = 0; sort_orders[f][i] && i < SORT_RANKS - 2; i++)
+            sort_order_atoms[f][i] = service_atom(sort_orders[f][i]);
+    }
+    sort_atoms_ready = true;
+}
+
+static const char *sort_field_atom(const Service *svc, enum sort_field field)
+{
+    switch (field)
+    {
+    case SORT_BY_STATE:
+        return svc->unit_file_state;
+    case SORT_BY_ACTIVE:
+        return svc->active;
+    case SORT_BY_SUB:
+        return svc->sub;
+    default:
+        return NULL;
+    }
+}
+
+/* Position of a unit's state in the order of the column */
+static int sort_rank(const Service *svc, enum sort_field field)
+{
+    const char *atom = sort_field_atom(svc, field);
+    int i;
+
+    if (!sort_atoms_ready)
+        sort_init_atoms();
+
+    if (!atom)
+        return 0;
+
+    for (i = 0; sort_order_atoms[field][i]; i++)
+    {
+        if (sort_order_atoms[field][i] == atom)
+            return i + 1;
+    }
+    return i + 1;
+}
+
+/* Append byte c to the key being encoded, counting bytes beyond size */
+#define SORT_EMIT(c)                      \
+    {                                     \
+        unsigned char emitted = (c);      \
+        if (n < size)                     \
+            out[n] = emitted;             \
+        n++;                              \
+    }
+
+/* Encode a string so that comparing encodings with memcmp() orders like
+ * sort_natural_compare(). A run of digits becomes the count of its
+ * significant digits, kept within '0' to '9' so it orders against other
+ * characters like the digits do, followed by the digits. Returns the
+ * length of the full encoding, of which at most size bytes are written. */
+static size_t sort_encode(const char *str, unsigned char *out, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)(str ? str : "");
+    size_t n = 0;
+
+    while (*p)
+    {
+        const unsigned char *digits = NULL;
+        size_t len = 0;
+
+        if (!SORT_IS_DIGIT(*p))
+        {
+            SORT_EMIT(*p++);
+            continue;
+        }
+
+        while (*p == '0')
+            p++;
+        for (digits = p; SORT_IS_DIGIT(*p); p++)
+            len++;
+
+        // Runs of nine digits or more carry their length in a second byte
+        if (len < 9)
+            SORT_EMIT('0' + len)
+        else
+        {
+            SORT_EMIT('9');
+            SORT_EMIT(len > 255 ? 255 : len);
+        }
+
+        for (size_t i = 0; i < len; i++)
+            SORT_EMIT(digits[i]);
+    }
+    return n;
+}
+
+/**
+ * Packs the first bytes of the natural order encoding of a string into an
+ * integer, so most comparisons of names and descriptions are a single
+ * integer one. Strings with equal prefixes must be compared in full.
+ *
+ * @param str The string
+ * @return The prefix, zero padded
+ */
+uint64_t sort_prefix(const char *str)
+{
+    unsigned char bytes[8] = {0};
+    uint64_t prefix = 0;
+
+    sort_encode(str, bytes, sizeof(bytes));
+    for (int i = 0; i < 8; i++)
+        prefix = prefix << 8 | bytes[i];
+    return prefix;
+}
+
+/**
+ * Compares strings with runs of digits ordered by their value, so
+ * "getty@tty9" sorts before "getty@tty10".
+ *
+ * @param a The first string
+ * @param b The second string
+ * @return Less than, equal to or greater than zero like strcmp()
+ */
+int sort_natural_compare(const char *a, const char *b)
+{
+    const unsigned char *p = (const unsigned char *)(a ? a : "");
+    const unsigned char *q = (const unsigned char *)(b ? b : "");
+
+    while (*p && *q)
+    {
+        size_t lp = 0, lq = 0;
+        int rc;
+
+        if (!SORT_IS_DIGIT(*p) || !SORT_IS_DIGIT(*q))
+        {
+            if (*p != *q)
+                return *p - *q;
+            p++;
+            q++;
+            continue;
+        }
+
+        while (*p == '0')
+            p++;
+        while (*q == '0')
+            q++;
+        while (SORT_IS_DIGIT(p[lp]))
+            lp++;
+        while (SORT_IS_DIGIT(q[lq]))
+            lq++;
+
+        if (lp != lq)
+            return lp < lq ? -1 : 1;
+
+        rc = memcmp(p, q, lp);
+        if (rc)
+            return rc;
+
+        p += lp;
+        q += lq;
+    }
+
+    return *p - *q;
+}
+
+static int sort_string_compare(uint64_t prefix_a, const char *a, uint64_t prefix_b, const char *b)
+{
+    if (prefix_a != prefix_b)
+        return prefix_a < prefix_b ? -1 : 1;
+    return sort_natural_compare(a, b);
+}
+
+static int sort_compare_key(const Service *a, const Service *b, sort_key key)
+{
+    int result;
+
+    switch (key.field)
+    {
+    case SORT_BY_UNIT:
+        result = sort_string_compare(a->unit_key, a->unit, b->unit_key, b->unit);
+        break;
+
+    case SORT_BY_DESCRIPTION:
+        result = sort_string_compare(a->description_key, a->description,
+                                     b->description_key, b->description);
+        break;
+
+    default:
+        result = sort_rank(a, key.field) - sort_rank(b, key.field);
+        break;
+    }
+
+    return key.descending ? -result : result;
+}
+
+/**
+ * Compares two units by the columns of an order.
+ *
+ * Names and descriptions order naturally, states by their position in
+ * the order of the column. A later column only decides where the earlier
+ * ones are equal. Equal units compare as 0, callers needing a total order
+ * break ties themselves.
+ *
+ * @param a The first unit
+ * @param b The second unit
+ * @param order The columns and their directions
+ * @return Less than, equal to or greater than zero like strcmp()
+ */
+int sort_compare(const Service *a, const Service *b, const sort_order *order)
+{
+    for (int i = 0; i < order->count; i++)
+    {
+        int result = sort_compare_key(a, b, order->keys[i]);
+
+        if (result)
+            return result;
+    }
+    return 0;
+}
+
+/* States have few ranks, one counting pass orders them */
+static int sort_counting(Service **units, int count, sort_key key)
+{
+    int starts[SORT_RANKS + 1] = {0};
+    Service **out = NULL;
+    unsigned char *ranks = NULL;
+
+    out = malloc(count * sizeof(Service *));
+    ranks = malloc(count);
+    if (!out || !ranks)
+    {
+        free(out);
+        free(ranks);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int rank = sort_rank(units[i], key.field);
+
+        ranks[i] = key.descending ? SORT_RANKS - 1 - rank : rank;
+        starts[ranks[i] + 1]++;
+    }
+
+    for (int r = 0; r < SORT_RANKS; r++)
+        starts[r + 1] += starts[r];
+
+    for (int i = 0; i < count; i++)
+        out[starts[ranks[i]]++] = units[i];
+
+    memcpy(units, out, count * sizeof(Service *));
+    free(out);
+    free(ranks);
+    return 0;
+}
+
+/* Eight bytes of a composite key from depth on, zero padded */
+static uint64_t sort_chunk(const sort_item *item, size_t depth)
+{
+    uint64_t chunk = 0;
+
+    for (size_t i = depth; i < depth + 8; i++)
+        chunk = chunk << 8 | (i < item->len ? item->key[i] : 0);
+    return chunk;
+}
+
+/* Below this many units clearing the histograms costs more than merging */
+#define SORT_RADIX_MIN 1024
+
+/* One byte of a chunk, least significant first */
+static inline unsigned sort_digit(uint64_t chunk, int byte)
+{
+    return (chunk >> (8 * byte)) & 0xff;
+}
+
+/* Stable bottom up merge sort of items on their chunks */
+static void sort_merge_chunks(sort_item *items, sort_item *tmp, int count)
+{
+    sort_item *from = items, *to = tmp;
+
+    for (int width = 1; width < count; width *= 2)
+    {
+        sort_item *swap = NULL;
+
+        for (int lo = 0; lo < count; lo += 2 * width)
+        {
+            int mid = lo + width < count ? lo + width : count;
+            int hi = lo + 2 * width < count ? lo + 2 * width : count;
+            int i = lo, j = mid, k = lo;
+
+            // Taking from the left on ties keeps the sort stable
+            while (i < mid && j < hi)
+                to[k++] = from[j].chunk < from[i].chunk ? from[j++] : from[i++];
+            while (i < mid)
+                to[k++] = from[i++];
+            while (j < hi)
+                to[k++] = from[j++];
+        }
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != items)
+        memcpy(items, from, count * sizeof(sort_item));
+}
+
+/* Stable LSD radix sort of items on their chunks, a byte per pass. The
+ * histograms of all bytes are counted in one go, and bytes all items agree
+ * on are skipped, which for names is most of them. */
+static void sort_radix_chunks(sort_item *items, sort_item *tmp, int count)
+{
+    static uint32_t counts[8][256];
+    sort_item *from = items, *to = tmp;
+
+    if (count < SORT_RADIX_MIN)
+    {
+        sort_merge_chunks(items, tmp, count);
+        return;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < count; i++)
+    {
+        for (int b = 0; b < 8; b++)
+            counts[b][sort_digit(items[i].chunk, b)]++;
+    }
+
+    for (int b = 0; b < 8; b++)
+    {
+        uint32_t offset = 0;
+        sort_item *swap = NULL;
+
+        if (counts[b][sort_digit(from[0].chunk, b)] == (uint32_t)count)
+            continue;
+
+        for (int d = 0; d < 256; d++)
+        {
+            uint32_t n = counts[b][d];
+
+            counts[b][d] = offset;
+            offset += n;
+        }
+
+        for (int i = 0; i < count; i++)
+            to[counts[b][sort_digit(from[i].chunk, b)]++] = from[i];
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != items)
+        memcpy(items, from, count * sizeof(sort_item));
+}
+
+/* Sort on the chunk at depth, then each run of units whose keys agree so
+ * far on the next chunk. Long shared beginnings such as "systemd-" or
+ * "sys-devices-" thus cost integer comparisons only. */
+static void sort_chunks(sort_item *items, sort_item *tmp, int count, size_t depth)
+{
+    int i = 0;
+
+    sort_radix_chunks(items, tmp, count);
+
+    while (i < count)
+    {
+        int j = i + 1;
+
+        while (j < count && items[j].chunk == items[i].chunk)
+            j++;
+
+        // Keys are prefix free, so equal chunks mean equal lengths so far.
+        // Keys that ended within this chunk are equal and keep their order.
+        if (j - i > 1 && items[i].len > depth + 8)
+        {
+            for (int k = i; k < j; k++)
+                items[k].chunk = sort_chunk(&items[k], depth + 8);
+            sort_chunks(items + i, tmp + i, j - i, depth + 8);
+        }
+        i = j;
+    }
+}
+
+static const char *sort_field_string(const Service *svc, enum sort_field field)
+{
+    return field == SORT_BY_UNIT ? svc->unit : svc->description;
+}
+
+/* Append the part of a composite key for one column. States are a rank
+ * byte, strings their natural order encoding ended by a byte the encoding
+ * never holds, so keys stay prefix free. Descending columns have their
+ * bytes inverted. Returns the bytes written. */
+static size_t sort_compose(const Service *svc, sort_key key, unsigned char *out, size_t size)
+{
+    unsigned char flip = key.descending ? 0xff : 0;
+    size_t n = 0;
+
+    if (key.field != SORT_BY_UNIT && key.field != SORT_BY_DESCRIPTION)
+    {
+        out[0] = sort_rank(svc, key.field) ^ flip;
+        return 1;
+    }
+
+    n = sort_encode(sort_field_string(svc, key.field), out, size - 1);
+    for (size_t i = 0; i < n; i++)
+        out[i] ^= flip;
+    out[n] = flip;
+    return n + 1;
+}
+
+/* Units are sorted on a composite key of all columns of the order, built
+ * once, then radix sorted chunk by chunk. A second or third column thus
+ * costs a few bytes more per key rather than another sort. */
+static int sort_composite(Service **units, int count, const sort_order *order)
+{
+    sort_item *items = NULL, *tmp = NULL;
+    unsigned char *keys = NULL, *k = NULL;
+    size_t total = 0;
+
+    items = malloc(count * sizeof(sort_item));
+    tmp = malloc(count * sizeof(sort_item));
+    if (!items || !tmp)
+        goto oom;
+
+    // A digit grows into at most two bytes, strings need their end byte
+    for (int i = 0; i < count; i++)
+    {
+        for (int o = 0; o < order->count; o++)
+        {
+            const char *str = sort_field_string(units[i], order->keys[o].field);
+            bool string = order->keys[o].field == SORT_BY_UNIT || order->keys[o].field == SORT_BY_DESCRIPTION;
+
+            total += string ? 2 * (str ? strlen(str) : 0) + 1 : 1;
+        }
+    }
+
+    keys = malloc(total);
+    if (!keys)
+        goto oom;
+
+    k = keys;
+    for (int i = 0; i < count; i++)
+    {
+        items[i].svc = units[i];
+        items[i].key = k;
+        for (int o = 0; o < order->count; o++)
+            k += sort_compose(units[i], order->keys[o], k, total - (k - keys));
+        items[i].len = k - items[i].key;
+        items[i].chunk = sort_chunk(&items[i], 0);
+    }
+
+    sort_chunks(items, tmp, count, 0);
+
+    for (int i = 0; i < count; i++)
+        units[i] = items[i].svc;
+
+    free(keys);
+    free(items);
+    free(tmp);
+    return 0;
+
+oom:
+    free(keys);
+    free(items);
+    free(tmp);
+    return -1;
+}
+
+/**
+ * Sorts units by the columns of an order. The sort is stable, units the
+ * columns do not tell apart keep their order.
+ *
+ * @param units The units to sort
+ * @param count The number of units
+ * @param order The columns and their directions
+ * @return 0 on success, -1 if out of memory, the units are then unchanged
+ */
+int sort_units(Service **units, int count, const sort_order *order)
+{
+    if (count < 2 || order->count == 0)
+        return 0;
+
+    // A single state column needs no keys, one counting pass sorts it
+    if (order->count == 1 && order->keys[0].field != SORT_BY_UNIT &&
+        order->keys[0].field != SORT_BY_DESCRIPTION)
+        return sort_counting(units, count, order->keys[0]);
+    return sort_composite(units, count, order);
+}
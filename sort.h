@@ -0,0 +1,38 @@
+#ifndef _SORT_H_
+#define _SORT_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include "service.h"
+
+#define SORT_MAX_KEYS 3
+
+enum sort_field
+{
+    SORT_BY_UNIT,
+    SORT_BY_STATE,
+    SORT_BY_ACTIVE,
+    SORT_BY_SUB,
+    SORT_BY_DESCRIPTION,
+    MAX_SORT_FIELDS
+};
+
+/* A column to order units by and its direction */
+typedef struct sort_key
+{
+    enum sort_field field;
+    bool descending;
+} sort_key;
+
+/* The columns to order units by, the first deciding most */
+typedef struct sort_order
+{
+    sort_key keys[SORT_MAX_KEYS];
+    int count;
+} sort_order;
+
+uint64_t sort_prefix(const char *str);
+int sort_natural_compare(const char *a, const char *b);
+int sort_compare(const Service *a, const Service *b, const sort_order *order);
+int sort_units(Service **units, int count, const sort_order *order);
+
+#endif
@@ -0,0 +1,424 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include "trigram.h"
+#include "service.h"
+
+#define TRIGRAM_INITIAL_TABLE 4096
+#define TRIGRAM_INITIAL_POSTING 4
+
+static uint32_t trigram_pack(const char *s)
+{
+    return (uint32_t)(unsigned char)s[0] << 16 |
+           (uint32_t)(unsigned char)s[1] << 8 |
+           (uint32_t)(unsigned char)s[2];
+}
+
+static uint32_t trigram_hash(uint32_t trigram)
+{
+    return trigram * 2654435761u;
+}
+
+static int compare_trigrams(const void *a, const void *b)
+{
+    uint32_t t1 = *(const uint32_t *)a;
+    uint32_t t2 = *(const uint32_t *)b;
+
+    return (t1 > t2) - (t1 < t2);
+}
+
+/* Append every trigram of a key, the result may hold duplicates */
+static int trigram_collect(const char *key, int len, uint32_t **trigrams, int *count, int *size)
+{
+    if (!key || len < 3)
+        return 0;
+
+    if (*count + len - 2 > *size)
+    {
+        int size2 = *count + len - 2;
+        uint32_t *t = realloc(*trigrams, size2 * sizeof(uint32_t));
+
+        if (!t)
+            return -ENOMEM;
+        *trigrams = t;
+        *size = size2;
+    }
+
+    for (int i = 0; i + 2 < len; i++)
+        (*trigrams)[(*count)++] = trigram_pack(&key[i]);
+    return 0;
+}
+
+/* Sort the trigrams and drop duplicates, returning the distinct count */
+static int trigram_distinct(uint32_t *trigrams, int count)
+{
+    int n = 0;
+
+    if (count == 0)
+        return 0;
+
+    qsort(trigrams, count, sizeof(uint32_t), compare_trigrams);
+    for (int i = 1; i < count; i++)
+    {
+        if (trigrams[i] != trigrams[n])
+            trigrams[++n] = trigrams[i];
+    }
+    return n + 1;
+}
+
+/* The distinct trigrams of both search keys of a service */
+static int trigram_service_set(Service *svc, uint32_t **trigrams)
+{
+    int count = 0, size = 0;
+
+    *trigrams = NULL;
+    if (trigram_collect(svc->search_unit, svc->search_unit ? strlen(svc->search_unit) : 0,
+                        trigrams, &count, &size) < 0 ||
+        trigram_collect(svc->search_description, svc->search_description ? strlen(svc->search_description) : 0,
+                        trigrams, &count, &size) < 0)
+    {
+        free(*trigrams);
+        *trigrams = NULL;
+        return -ENOMEM;
+    }
+
+    return trigram_distinct(*trigrams, count);
+}
+
+static trigram_posting *trigram_find(trigram_index *index, uint32_t trigram)
+{
+    uint32_t mask = index->table_size - 1;
+
+    if (!index->table)
+        return NULL;
+
+    for (uint32_t i = trigram_hash(trigram) & mask;; i = (i + 1) & mask)
+    {
+        trigram_posting *p = &index->table[i];
+
+        if (!p->ids)
+            return NULL;
+        if (p->trigram == trigram)
+            return p;
+    }
+}
+
+static int trigram_grow(trigram_index *index)
+{
+    uint32_t size = index->table_size ? index->table_size * 2 : TRIGRAM_INITIAL_TABLE;
+    trigram_posting *table = calloc(size, sizeof(trigram_posting));
+
+    if (!table)
+        return -ENOMEM;
+
+    for (uint32_t i = 0; i < index->table_size; i++)
+    {
+        trigram_posting *p = &index->table[i];
+        uint32_t j;
+
+        if (!p->ids)
+            continue;
+
+        for (j = trigram_hash(p->trigram) & (size - 1); table[j].ids; j = (j + 1) & (size - 1))
+            ;
+        table[j] = *p;
+    }
+
+    free(index->table);
+    index->table = table;
+    index->table_size = size;
+    return 0;
+}
+
+/* Find the posting list of a trigram, creating it if needed */
+static trigram_posting *trigram_posting_get(trigram_index *index, uint32_t trigram)
+{
+    trigram_posting *p = trigram_find(index, trigram);
+    uint32_t mask;
+
+    if (p)
+        return p;
+
+    // Keep the table at most half full so probe sequences stay short
+    if ((index->table_used + 1) * 2 > index->table_size && trigram_grow(index) < 0)
+        return NULL;
+
+    mask = index->table_size - 1;
+    for (uint32_t i = trigram_hash(trigram) & mask;; i = (i + 1) & mask)
+    {
+        p = &index->table[i];
+        if (p->ids)
+            continue;
+
+        p->ids = malloc(TRIGRAM_INITIAL_POSTING * sizeof(uint32_t));
+        if (!p->ids)
+            return NULL;
+        p->trigram = trigram;
+        p->count = 0;
+        p->size = TRIGRAM_INITIAL_POSTING;
+        index->table_used++;
+        return p;
+    }
+}
+
+/* Position of the first id not below the one given */
+static uint32_t trigram_posting_search(trigram_posting *p, uint32_t id)
+{
+    uint32_t lo = 0, hi = p->count;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (p->ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static bool trigram_posting_contains(trigram_posting *p, uint32_t id)
+{
+    uint32_t i = trigram_posting_search(p, id);
+
+    return i < p->count && p->ids[i] == id;
+}
+
+static int trigram_posting_insert(trigram_posting *p, uint32_t id)
+{
+    uint32_t i;
+
+    if (p->count == p->size)
+    {
+        uint32_t *ids = realloc(p->ids, p->size * 2 * sizeof(uint32_t));
+
+        if (!ids)
+            return -ENOMEM;
+        p->ids = ids;
+        p->size *= 2;
+    }
+
+    // Fresh ids are the highest, so this is nearly always an append
+    i = p->count && p->ids[p->count - 1] < id ? p->count : trigram_posting_search(p, id);
+    memmove(&p->ids[i + 1], &p->ids[i], (p->count - i) * sizeof(uint32_t));
+    p->ids[i] = id;
+    p->count++;
+    return 0;
+}
+
+static void trigram_posting_remove(trigram_posting *p, uint32_t id)
+{
+    uint32_t i = trigram_posting_search(p, id);
+
+    if (i == p->count || p->ids[i] != id)
+        return;
+
+    memmove(&p->ids[i], &p->ids[i + 1], (p->count - i - 1) * sizeof(uint32_t));
+    p->count--;
+}
+
+static int trigram_acquire_id(trigram_index *index, Service *svc)
+{
+    uint32_t id;
+
+    if (index->free_count)
+        id = index->free_ids[--index->free_count];
+    else
+    {
+        // Id 0 means a service is not indexed
+        if (index->next_id == 0)
+            index->next_id = 1;
+
+        if (index->next_id >= index->slots_size)
+        {
+            uint32_t size = index->slots_size ? index->slots_size * 2 : 1024;
+            Service **slots = realloc(index->slots, size * sizeof(Service *));
+            uint32_t *free_ids = realloc(index->free_ids, size * sizeof(uint32_t));
+
+            if (slots)
+                index->slots = slots;
+            if (free_ids)
+                index->free_ids = free_ids;
+            if (!slots || !free_ids)
+                return -ENOMEM;
+            index->slots_size = size;
+        }
+        id = index->next_id++;
+    }
+
+    index->slots[id] = svc;
+    svc->trigram_id = id;
+    return 0;
+}
+
+/**
+ * Adds the search keys of a service to the index.
+ *
+ * The service keeps the id it is indexed under until it is removed again.
+ *
+ * @param index The index to add to
+ * @param svc The service, its search keys must be set
+ * @return 0 on success, or a negative error code
+ */
+int trigram_add(trigram_index *index, Service *svc)
+{
+    uint32_t *trigrams = NULL;
+    int count, rc = 0;
+
+    if (!svc->trigram_id && trigram_acquire_id(index, svc) < 0)
+        return -ENOMEM;
+
+    count = trigram_service_set(svc, &trigrams);
+    if (count < 0)
+        return count;
+
+    for (int i = 0; i < count && rc == 0; i++)
+    {
+        trigram_posting *p = trigram_posting_get(index, trigrams[i]);
+
+        rc = p ? trigram_posting_insert(p, svc->trigram_id) : -ENOMEM;
+    }
+
+    free(trigrams);
+    return rc;
+}
+
+/**
+ * Removes a service from the index.
+ *
+ * Must be called before its search keys change or it is freed, as the
+ * posting lists to remove it from are found through the current keys.
+ *
+ * @param index The index to remove from
+ * @param svc The indexed service
+ */
+void trigram_remove(trigram_index *index, Service *svc)
+{
+    uint32_t *trigrams = NULL;
+    int count;
+
+    if (!svc->trigram_id)
+        return;
+
+    count = trigram_service_set(svc, &trigrams);
+    if (count < 0)
+    {
+        // Cannot tell which lists hold the id, sweep them all
+        for (uint32_t i = 0; i < index->table_size; i++)
+        {
+            if (index->table[i].ids)
+                trigram_posting_remove(&index->table[i], svc->trigram_id);
+        }
+        count = 0;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        trigram_posting *p = trigram_find(index, trigrams[i]);
+
+        if (p)
+            trigram_posting_remove(p, svc->trigram_id);
+    }
+    free(trigrams);
+
+    // Never fails, the free list is sized along with the slots
+    index->slots[svc->trigram_id] = NULL;
+    index->free_ids[index->free_count++] = svc->trigram_id;
+    svc->trigram_id = 0;
+}
+
+/**
+ * Finds the services whose search keys contain every trigram of a term.
+ *
+ * This is a superset of the services containing the term as a substring,
+ * the caller must still verify each candidate.
+ *
+ * @param index The index to search
+ * @param term The lowercased term to look up
+ * @param len The length of the term, at least 3
+ * @param found Receives an allocated array of candidates, or NULL if none
+ * @return The number of candidates, -EINVAL if the term is too short to
+ * use the index, or another negative error code
+ */
+int trigram_lookup(trigram_index *index, const char *term, int len, Service ***found)
+{
+    trigram_posting **postings = NULL;
+    trigram_posting *smallest = NULL;
+    uint32_t *trigrams = NULL;
+    int count = 0, size = 0, n = 0;
+
+    *found = NULL;
+    if (len < 3)
+        return -EINVAL;
+
+    if (trigram_collect(term, len, &trigrams, &count, &size) < 0)
+        return -ENOMEM;
+    count = trigram_distinct(trigrams, count);
+
+    postings = malloc(count * sizeof(trigram_posting *));
+    if (!postings)
+    {
+        free(trigrams);
+        return -ENOMEM;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        postings[i] = trigram_find(index, trigrams[i]);
+        if (!postings[i] || postings[i]->count == 0)
+            goto fin;
+        if (!smallest || postings[i]->count < smallest->count)
+            smallest = postings[i];
+    }
+
+    *found = malloc(smallest->count * sizeof(Service *));
+    if (!*found)
+    {
+        n = -ENOMEM;
+        goto fin;
+    }
+
+    // Walk the shortest list, probing the others for each of its ids
+    for (uint32_t i = 0; i < smallest->count; i++)
+    {
+        uint32_t id = smallest->ids[i];
+        int j;
+
+        for (j = 0; j < count; j++)
+        {
+            if (postings[j] != smallest && !trigram_posting_contains(postings[j], id))
+                break;
+        }
+
+        if (j == count)
+            (*found)[n++] = index->slots[id];
+    }
+
+fin:
+    if (n <= 0)
+    {
+        free(*found);
+        *found = NULL;
+    }
+    free(postings);
+    free(trigrams);
+    return n;
+}
+
+/**
+ * Releases all memory held by the index.
+ *
+ * @param index The index to release
+ */
+void trigram_free(trigram_index *index)
+{
+    for (uint32_t i = 0; i < index->table_size; i++)
+        free(index->table[i].ids);
+
+    free(index->table);
+    free(index->slots);
+    free(index->free_ids);
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,38 @@
+#ifndef _TRIGRAM_H_
+#define _TRIGRAM_H_
+#include <stdint.h>
+
+struct Service;
+
+/* Sorted ids of every unit whose search keys contain one trigram */
+typedef struct trigram_posting
+{
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t size;
+    uint32_t *ids;
+} trigram_posting;
+
+/* Maps each trigram of the lowercased unit names and descriptions to the
+ * units containing it. Units are referred to by a small id so the posting
+ * lists stay compact, slots maps an id back to its unit. */
+typedef struct trigram_index
+{
+    trigram_posting *table;
+    uint32_t table_size;
+    uint32_t table_used;
+
+    struct Service **slots;
+    uint32_t slots_size;
+    uint32_t next_id;
+
+    uint32_t *free_ids;
+    uint32_t free_count;
+} trigram_index;
+
+int trigram_add(trigram_index *index, struct Service *svc);
+void trigram_remove(trigram_index *index, struct Service *svc);
+int trigram_lookup(trigram_index *index, const char *term, int len, struct Service ***found);
+void trigram_free(trigram_index *index);
+
+#endif